@@ -0,0 +1,216 @@
+// Minimal JSON reader, sufficient for the configuration files read by the simulators in contrib, along with
+// helpers to read their options and the numbers of their traces.
+#pragma once
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace config_json {
+  struct json_value {
+    enum class kind { null, boolean, number, string, array, object };
+
+    kind type = kind::null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<json_value> array;
+    std::vector<std::pair<std::string, json_value>> object;
+
+    const json_value* find(const char* key) const {
+      for (const auto& member : object) {
+        if (member.first == key)
+          return &member.second;
+      }
+      return nullptr;
+    }
+  };
+
+  class json_reader {
+  public:
+    explicit json_reader(const std::string& text) : m_text(text) {}
+
+    bool read(json_value& value, std::string& error) {
+      if (!read_value(value, 0) || (skip_space(), m_pos != m_text.size())) {
+        error = "invalid JSON at offset " + std::to_string(m_pos);
+        return false;
+      }
+      return true;
+    }
+
+  private:
+    void skip_space() {
+      while (m_pos < m_text.size() && (m_text[m_pos] == ' ' || m_text[m_pos] == '\t' || m_text[m_pos] == '\r' || m_text[m_pos] == '\n'))
+        ++m_pos;
+    }
+
+    bool consume(char expected) {
+      skip_space();
+      if (m_pos < m_text.size() && m_text[m_pos] == expected) {
+        ++m_pos;
+        return true;
+      }
+      return false;
+    }
+
+    bool read_literal(const char* literal) {
+      const size_t length = std::char_traits<char>::length(literal);
+      if (m_text.compare(m_pos, length, literal) != 0)
+        return false;
+      m_pos += length;
+      return true;
+    }
+
+    bool read_string(std::string& output) {
+      if (!consume('"'))
+        return false;
+      while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+        char c = m_text[m_pos++];
+        if (c == '\\') {
+          if (m_pos >= m_text.size())
+            return false;
+          c = m_text[m_pos++];
+          switch (c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'u':
+              // configurations only need ASCII, so other code points are replaced
+              if (m_pos + 4 > m_text.size())
+                return false;
+              {
+                uint32_t code = 0;
+                for (size_t i = 0; i < 4; ++i) {
+                  const char digit = m_text[m_pos + i];
+                  if (!std::isxdigit(static_cast<unsigned char>(digit)))
+                    return false;
+                  code = code * 16 + static_cast<uint32_t>(digit <= '9' ? digit - '0' : (digit | 0x20) - 'a' + 10);
+                }
+                c = code < 0x80 ? static_cast<char>(code) : '?';
+              }
+              m_pos += 4;
+              break;
+            default: break;
+          }
+        }
+        output.push_back(c);
+      }
+      return m_pos++ < m_text.size();
+    }
+
+    bool read_value(json_value& value, int depth) {
+      if (depth > 64)
+        return false;
+      skip_space();
+      if (m_pos >= m_text.size())
+        return false;
+
+      const char c = m_text[m_pos];
+      if (c == '{') {
+        value.type = json_value::kind::object;
+        ++m_pos;
+        if (consume('}'))
+          return true;
+        do {
+          std::pair<std::string, json_value> member;
+          if (!read_string(member.first) || !consume(':') || !read_value(member.second, depth + 1))
+            return false;
+          value.object.push_back(std::move(member));
+        } while (consume(','));
+        return consume('}');
+      }
+      if (c == '[') {
+        value.type = json_value::kind::array;
+        ++m_pos;
+        if (consume(']'))
+          return true;
+        do {
+          value.array.emplace_back();
+          if (!read_value(value.array.back(), depth + 1))
+            return false;
+        } while (consume(','));
+        return consume(']');
+      }
+      if (c == '"') {
+        value.type = json_value::kind::string;
+        return read_string(value.string);
+      }
+      if (read_literal("true") || read_literal("false")) {
+        value.type = json_value::kind::boolean;
+        value.boolean = c == 't';
+        return true;
+      }
+      if (read_literal("null")) {
+        value.type = json_value::kind::null;
+        return true;
+      }
+
+      const char* begin = m_text.c_str() + m_pos;
+      char* end = nullptr;
+      value.type = json_value::kind::number;
+      value.number = std::strtod(begin, &end);
+      m_pos += static_cast<size_t>(end - begin);
+      return end != begin;
+    }
+
+    const std::string& m_text;
+    size_t m_pos = 0;
+  };
+
+  inline bool read_object(const std::string& json, json_value& root, std::string& error) {
+    if (!json_reader(json).read(root, error))
+      return false;
+    if (root.type != json_value::kind::object) {
+      error = "configuration is not a JSON object";
+      return false;
+    }
+    return true;
+  }
+
+  // Read an optional number member into `output`, which keeps its default if the member is missing. Numbers
+  // that `T` cannot represent are rejected rather than converted, as are fractions for integer types.
+  template <typename T>
+  bool read_number(const json_value& object, const char* key, T& output, std::string& error) {
+    static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value, "read_number only reads numbers");
+    const json_value* member = object.find(key);
+    if (member == nullptr)
+      return true;
+    if (member->type != json_value::kind::number) {
+      error = std::string("'") + key + "' must be a number";
+      return false;
+    }
+
+    const double number = member->number;
+    if (std::is_integral<T>::value && number != std::trunc(number)) {
+      error = std::string("'") + key + "' must be an integer";
+      return false;
+    }
+    // the maximum of 64-bit integers is not representable as a double, so compare with the exclusive bound
+    // 2^digits instead, which is exact for every integer type
+    const double upper = std::is_integral<T>::value ? std::ldexp(1.0, std::numeric_limits<T>::digits) : std::numeric_limits<T>::max();
+    const bool in_range = std::is_integral<T>::value ? number < upper : number <= upper;
+    if (!std::isfinite(number) || number < static_cast<double>(std::numeric_limits<T>::lowest()) || !in_range) {
+      error = std::string("'") + key + "' is out of range";
+      return false;
+    }
+    output = static_cast<T>(number);
+    return true;
+  }
+
+  // Parse an unsigned decimal or `0x` hexadecimal number, as used in traces.
+  inline bool parse_number(const std::string& text, uint64_t& value) {
+    if (text.empty() || text[0] == '-')
+      return false;
+    char* end = nullptr;
+    value = std::strtoull(text.c_str(), &end, 0);
+    return *end == '\0';
+  }
+} // namespace config_json
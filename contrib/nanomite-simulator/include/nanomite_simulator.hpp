@@ -0,0 +1,90 @@
+// Offline simulation of nanomite restoration against recorded nanomite hits.
+//
+// A trace lists how often each nanomite was executed over time, either as individual executions from a
+// branch trace or as counts from a sampled profile, along with frame boundaries. The simulator replays it
+// against the `nanomites` options of a module configuration, and predicts the traps into the runtime, when
+// hot nanomites get restored, and the remaining overhead per frame, so that thresholds can be chosen before
+// packing.
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace nanomite_simulator {
+  // Options of the `nanomites` object of the module configuration, with the defaults of its schema, and the
+  // parameters of the runtime that the module configuration does not expose.
+  struct settings {
+    uint32_t removal_threshold = 100;
+    uint32_t removal_total_threshold = 0;
+    double max_removal_ratio = 0.3;
+
+    // interval of the periodic removal task, which is less than a second in the runtime
+    uint32_t removal_interval_ms = 500;
+
+    // estimated cost of dispatching a single nanomite
+    double trap_cost_us = 2;
+  };
+
+  enum class event_type {
+    hit,         // hit <time_us> <rva> [count]
+    frame_begin, // frame <time_us>
+  };
+
+  struct event {
+    uint64_t time_us;
+    event_type type;
+    uint32_t rva;
+    uint32_t count;
+  };
+
+  struct trace {
+    // total count of nanomites in the module from a `nanomites <count>` line, or 0 to use the count of
+    // nanomites hit in the trace
+    uint32_t total_nanomites = 0;
+    std::vector<event> events;
+  };
+
+  struct restoration {
+    uint64_t time_us; // relative to the start of the trace
+    uint32_t rva;
+    uint64_t interval_hits; // hits in the removal interval that led to the restoration
+    uint64_t total_traps;   // traps caused by the nanomite before it was restored
+  };
+
+  struct report {
+    uint64_t duration_us = 0;
+    uint32_t nanomites = 0;     // total count of nanomites used for max_removal_ratio
+    uint32_t hit_nanomites = 0; // nanomites executed at least once
+
+    uint64_t executions = 0; // executions of nanomites, whether restored or not
+    uint64_t traps = 0;      // executions that trapped into the runtime
+    double trap_overhead_ms = 0;
+
+    std::vector<restoration> restorations;
+    uint64_t removal_cap_reached_us = 0; // time max_removal_ratio stopped further restorations, or 0
+    uint64_t capped_traps = 0;           // traps of nanomites that qualified for restoration after the cap
+
+    // traps per frame, if the trace has frame events
+    uint64_t frames = 0;
+    double mean_frame_overhead_us = 0;
+    double p99_frame_overhead_us = 0;
+    double max_frame_overhead_us = 0;
+
+    // traps per frame in frames starting after the last restoration, which the overhead converges to
+    uint64_t settled_frames = 0;
+    double settled_frame_overhead_us = 0;
+  };
+
+  // Read a trace in the text format described above. Lines starting with '#' and empty lines are skipped.
+  // Numbers may be decimal or hexadecimal with a 0x prefix. Events must be ordered by time.
+  bool parse_trace(std::istream& input, trace& output, std::string& error);
+
+  // Apply the `nanomites` options of a module configuration to `output`. Returns false with an error if the
+  // configuration disables nanomites, as there is nothing to simulate.
+  bool load_module_config(const std::string& json, settings& output, std::string& error);
+
+  // Replay `input` against `config`.
+  report simulate(const trace& input, const settings& config);
+} // namespace nanomite_simulator
@@ -0,0 +1,242 @@
+#include "nanomite_simulator.hpp"
+
+#include "config_json.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <unordered_map>
+
+namespace nanomite_simulator {
+  namespace {
+    using config_json::json_reader;
+    using config_json::json_value;
+    using config_json::parse_number;
+    using config_json::read_number;
+
+    double percentile(std::vector<double> values, double fraction) {
+      if (values.empty())
+        return 0;
+      std::sort(values.begin(), values.end());
+      return values[static_cast<size_t>(static_cast<double>(values.size() - 1) * fraction)];
+    }
+
+    class simulation {
+    public:
+      simulation(const trace& input, const settings& config) : m_trace(input), m_config(config) {}
+
+      report run() {
+        if (m_trace.events.empty())
+          return m_result;
+
+        for (const event& e : m_trace.events) {
+          if (e.type == event_type::hit && m_index.emplace(e.rva, m_nanomites.size()).second)
+            m_nanomites.push_back(nanomite{e.rva});
+        }
+        m_result.hit_nanomites = static_cast<uint32_t>(m_nanomites.size());
+        m_result.nanomites = (std::max)(m_trace.total_nanomites, m_result.hit_nanomites);
+        m_max_removals = static_cast<uint32_t>(m_config.max_removal_ratio * m_result.nanomites);
+
+        m_start = m_trace.events.front().time_us;
+        m_next_removal = m_start + interval();
+        for (const event& e : m_trace.events) {
+          while (m_next_removal <= e.time_us) {
+            remove_hot(m_next_removal);
+            m_next_removal += interval();
+          }
+          if (e.type == event_type::frame_begin)
+            begin_frame(e.time_us);
+          else
+            hit(m_nanomites[m_index[e.rva]], e.count);
+        }
+        if (m_frame_started)
+          m_frame_traps.push_back({m_frame_start, m_current_frame_traps});
+
+        m_result.duration_us = m_trace.events.back().time_us - m_start;
+        m_result.trap_overhead_ms = static_cast<double>(m_result.traps) * m_config.trap_cost_us / 1000;
+        summarize_frames();
+        return m_result;
+      }
+
+    private:
+      struct nanomite {
+        uint32_t rva;
+        bool restored = false;
+        bool capped = false;
+        uint64_t interval_hits = 0;
+        uint64_t traps = 0;
+      };
+
+      uint64_t interval() const {
+        return uint64_t(m_config.removal_interval_ms) * 1000;
+      }
+
+      void hit(nanomite& target, uint32_t count) {
+        m_result.executions += count;
+        if (target.restored)
+          return;
+        if (target.interval_hits == 0)
+          m_active.push_back(static_cast<size_t>(&target - m_nanomites.data()));
+        target.interval_hits += count;
+        target.traps += count;
+        m_result.traps += count;
+        m_current_frame_traps += count;
+        if (target.capped)
+          m_result.capped_traps += count;
+      }
+
+      void begin_frame(uint64_t now) {
+        if (m_frame_started)
+          m_frame_traps.push_back({m_frame_start, m_current_frame_traps});
+        m_frame_started = true;
+        m_frame_start = now;
+        m_current_frame_traps = 0;
+      }
+
+      // Periodic removal task: restore nanomites hit at least `removal_threshold` times during the interval,
+      // and the heaviest ones while the total exceeds `removal_total_threshold`, up to `max_removal_ratio`.
+      void remove_hot(uint64_t now) {
+        std::sort(m_active.begin(), m_active.end(), [&](size_t a, size_t b) { return m_nanomites[a].interval_hits > m_nanomites[b].interval_hits; });
+
+        uint64_t remaining = 0;
+        for (size_t index : m_active)
+          remaining += m_nanomites[index].interval_hits;
+
+        for (size_t index : m_active) {
+          nanomite& target = m_nanomites[index];
+          const bool over_total = m_config.removal_total_threshold != 0 && remaining > m_config.removal_total_threshold;
+          if (target.interval_hits < m_config.removal_threshold && !over_total)
+            break;
+          remaining -= target.interval_hits;
+
+          if (m_removals >= m_max_removals) {
+            if (m_result.removal_cap_reached_us == 0 && m_max_removals != 0)
+              m_result.removal_cap_reached_us = now - m_start;
+            target.capped = true;
+            continue;
+          }
+          target.restored = true;
+          ++m_removals;
+          m_last_removal = now;
+          m_result.restorations.push_back(restoration{now - m_start, target.rva, target.interval_hits, target.traps});
+        }
+
+        for (size_t index : m_active)
+          m_nanomites[index].interval_hits = 0;
+        m_active.clear();
+      }
+
+      void summarize_frames() {
+        m_result.frames = m_frame_traps.size();
+        if (m_frame_traps.empty())
+          return;
+
+        std::vector<double> overhead;
+        double total = 0;
+        double settled = 0;
+        for (const auto& frame : m_frame_traps) {
+          const double us = static_cast<double>(frame.second) * m_config.trap_cost_us;
+          overhead.push_back(us);
+          total += us;
+          if (frame.first >= m_last_removal) {
+            settled += us;
+            ++m_result.settled_frames;
+          }
+        }
+        m_result.mean_frame_overhead_us = total / static_cast<double>(overhead.size());
+        m_result.p99_frame_overhead_us = percentile(overhead, 0.99);
+        m_result.max_frame_overhead_us = percentile(overhead, 1);
+        m_result.settled_frame_overhead_us = m_result.settled_frames != 0 ? settled / static_cast<double>(m_result.settled_frames) : 0;
+      }
+
+      const trace& m_trace;
+      const settings& m_config;
+      report m_result;
+
+      std::vector<nanomite> m_nanomites;
+      std::unordered_map<uint32_t, size_t> m_index;
+      std::vector<size_t> m_active; // nanomites hit during the current interval
+      uint32_t m_max_removals = 0;
+      uint32_t m_removals = 0;
+      uint64_t m_start = 0;
+      uint64_t m_next_removal = 0;
+      uint64_t m_last_removal = 0;
+
+      bool m_frame_started = false;
+      uint64_t m_frame_start = 0;
+      uint64_t m_current_frame_traps = 0;
+      std::vector<std::pair<uint64_t, uint64_t>> m_frame_traps; // start time and traps of each frame
+    };
+  } // namespace
+
+  bool parse_trace(std::istream& input, trace& output, std::string& error) {
+    std::string line;
+    uint64_t last_time = 0;
+    for (size_t line_number = 1; std::getline(input, line); ++line_number) {
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      if (line.empty() || line[0] == '#')
+        continue;
+
+      std::istringstream stream(line);
+      std::string kind;
+      std::vector<std::string> fields;
+      stream >> kind;
+      for (std::string field; stream >> field;)
+        fields.push_back(field);
+
+      const auto fail = [&](const char* expected) {
+        error = "line " + std::to_string(line_number) + ": expected '" + expected + "'";
+        return false;
+      };
+
+      uint64_t values[3] = {0, 0, 1};
+      event e{};
+      if (kind == "nanomites") {
+        if (fields.size() != 1 || !parse_number(fields[0], values[0]) || values[0] > UINT32_MAX)
+          return fail("nanomites <count>");
+        output.total_nanomites = static_cast<uint32_t>(values[0]);
+        continue;
+      } else if (kind == "hit") {
+        if (fields.size() < 2 || fields.size() > 3 || !parse_number(fields[0], values[0]) || !parse_number(fields[1], values[1]) ||
+            (fields.size() == 3 && !parse_number(fields[2], values[2])) || values[1] > UINT32_MAX || values[2] > UINT32_MAX)
+          return fail("hit <time_us> <rva> [count]");
+        e = event{values[0], event_type::hit, static_cast<uint32_t>(values[1]), static_cast<uint32_t>(values[2])};
+      } else if (kind == "frame") {
+        if (fields.size() != 1 || !parse_number(fields[0], values[0]))
+          return fail("frame <time_us>");
+        e = event{values[0], event_type::frame_begin, 0, 0};
+      } else {
+        error = "line " + std::to_string(line_number) + ": unknown event '" + kind + "'";
+        return false;
+      }
+
+      if (e.time_us < last_time) {
+        error = "line " + std::to_string(line_number) + ": events must be ordered by time";
+        return false;
+      }
+      last_time = e.time_us;
+      output.events.push_back(e);
+    }
+    return true;
+  }
+
+  bool load_module_config(const std::string& json, settings& output, std::string& error) {
+    json_value root;
+    if (!json_reader(json).read(root, error))
+      return false;
+
+    const json_value* nanomites = root.type == json_value::kind::object ? root.find("nanomites") : nullptr;
+    if (nanomites == nullptr || nanomites->type != json_value::kind::object) {
+      error = "nanomites are disabled in this configuration";
+      return false;
+    }
+    return read_number(*nanomites, "removal_threshold", output.removal_threshold, error) &&
+           read_number(*nanomites, "removal_total_threshold", output.removal_total_threshold, error) &&
+           read_number(*nanomites, "max_removal_ratio", output.max_removal_ratio, error);
+  }
+
+  report simulate(const trace& input, const settings& config) {
+    return simulation(input, config).run();
+  }
+} // namespace nanomite_simulator
@@ -0,0 +1,152 @@
+// Replays a recorded nanomite trace against one or more sets of thresholds, and compares the expected traps,
+// restorations and overhead per frame.
+//
+// Usage: simulate_nanomites <trace> [--module-config <json>]... [--thresholds <removal>,<total>,<ratio>]...
+//                           [--removal-interval-ms <ms>] [--trap-cost-us <us>] [--timeline]
+//
+// Each module configuration or set of thresholds is simulated separately and printed as one row. Without
+// any, the defaults of the module configuration schema are simulated.
+#include "nanomite_simulator.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+  bool read_file(const char* path, std::string& contents) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+    std::ostringstream stream;
+    stream << file.rdbuf();
+    contents = stream.str();
+    return true;
+  }
+
+  bool parse_thresholds(const char* text, nanomite_simulator::settings& output) {
+    unsigned long removal = 0;
+    unsigned long total = 0;
+    double ratio = 0;
+    char trailing = 0;
+    if (sscanf(text, "%lu,%lu,%lf%c", &removal, &total, &ratio, &trailing) != 3 || ratio < 0 || ratio > 1)
+      return false;
+    output.removal_threshold = static_cast<uint32_t>(removal);
+    output.removal_total_threshold = static_cast<uint32_t>(total);
+    output.max_removal_ratio = ratio;
+    return true;
+  }
+
+  void print_timeline(const std::string& name, const nanomite_simulator::report& r) {
+    printf("\n%s: %zu restorations\n", name.c_str(), r.restorations.size());
+    printf("  %10s %12s %14s %12s\n", "time", "rva", "interval hits", "traps");
+    for (const auto& restoration : r.restorations) {
+      printf("  %9.3fs %#12x %14llu %12llu\n", static_cast<double>(restoration.time_us) / 1e6, restoration.rva,
+             static_cast<unsigned long long>(restoration.interval_hits), static_cast<unsigned long long>(restoration.total_traps));
+    }
+    if (r.removal_cap_reached_us != 0)
+      printf("  max_removal_ratio reached at %.3fs, %llu traps afterwards on nanomites over the thresholds\n", static_cast<double>(r.removal_cap_reached_us) / 1e6,
+             static_cast<unsigned long long>(r.capped_traps));
+  }
+
+  void print_usage() {
+    fprintf(stderr,
+            "usage: simulate_nanomites <trace> [--module-config <json>]... [--thresholds <removal>,<total>,<ratio>]...\n"
+            "                          [--removal-interval-ms <ms>] [--trap-cost-us <us>] [--timeline]\n");
+  }
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* trace_path = nullptr;
+  bool timeline = false;
+  nanomite_simulator::settings base;
+  std::vector<std::pair<std::string, nanomite_simulator::settings>> configs;
+  std::vector<const char*> module_paths;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--module-config" && i + 1 < argc) {
+      module_paths.push_back(argv[++i]);
+    } else if (arg == "--thresholds" && i + 1 < argc) {
+      nanomite_simulator::settings config;
+      if (!parse_thresholds(argv[++i], config)) {
+        print_usage();
+        return 1;
+      }
+      configs.emplace_back(argv[i], config);
+    } else if (arg == "--removal-interval-ms" && i + 1 < argc) {
+      base.removal_interval_ms = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+    } else if (arg == "--trap-cost-us" && i + 1 < argc) {
+      base.trap_cost_us = strtod(argv[++i], nullptr);
+    } else if (arg == "--timeline") {
+      timeline = true;
+    } else if (trace_path == nullptr && arg[0] != '-') {
+      trace_path = argv[i];
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+  if (trace_path == nullptr || base.removal_interval_ms == 0 || base.trap_cost_us < 0) {
+    print_usage();
+    return 1;
+  }
+
+  std::string error;
+  nanomite_simulator::trace trace;
+  std::ifstream trace_file(trace_path);
+  if (!trace_file || !nanomite_simulator::parse_trace(trace_file, trace, error)) {
+    fprintf(stderr, "failed to read %s: %s\n", trace_path, trace_file ? error.c_str() : "cannot open file");
+    return 1;
+  }
+
+  // The runtime parameters given on the command line apply to every row.
+  for (auto& config : configs) {
+    config.second.removal_interval_ms = base.removal_interval_ms;
+    config.second.trap_cost_us = base.trap_cost_us;
+  }
+  for (const char* path : module_paths) {
+    std::string contents;
+    nanomite_simulator::settings config = base;
+    if (!read_file(path, contents) || !nanomite_simulator::load_module_config(contents, config, error)) {
+      fprintf(stderr, "failed to read %s: %s\n", path, error.empty() ? "cannot open file" : error.c_str());
+      return 1;
+    }
+    configs.emplace_back(path, config);
+  }
+  if (configs.empty())
+    configs.emplace_back("defaults", base);
+
+  std::vector<nanomite_simulator::report> reports;
+  for (const auto& config : configs)
+    reports.push_back(nanomite_simulator::simulate(trace, config.second));
+
+  const nanomite_simulator::report& first = reports.front();
+  printf("%zu events over %.1f s, %u of %u nanomites hit, %llu executions, %llu frames\n\n", trace.events.size(),
+         static_cast<double>(first.duration_us) / 1e6, first.hit_nanomites, first.nanomites, static_cast<unsigned long long>(first.executions),
+         static_cast<unsigned long long>(first.frames));
+  printf("%-28s %10s %10s %9s %9s %24s %14s\n", "config", "traps", "overhead", "restored", "settled", "us/frame avg/p99/max", "settled us/frame");
+
+  for (size_t i = 0; i < configs.size(); ++i) {
+    const nanomite_simulator::report& r = reports[i];
+    char per_frame[64];
+    snprintf(per_frame, sizeof(per_frame), "%.1f/%.1f/%.1f", r.mean_frame_overhead_us, r.p99_frame_overhead_us, r.max_frame_overhead_us);
+    char restored[32];
+    snprintf(restored, sizeof(restored), "%zu%s", r.restorations.size(), r.removal_cap_reached_us != 0 ? "*" : "");
+    const double settled = r.restorations.empty() ? 0 : static_cast<double>(r.restorations.back().time_us) / 1e6;
+
+    printf("%-28s %10llu %8.1fms %9s %8.2fs %24s %14.1f\n", configs[i].first.c_str(), static_cast<unsigned long long>(r.traps), r.trap_overhead_ms, restored,
+           settled, per_frame, r.settled_frame_overhead_us);
+  }
+  if (std::any_of(reports.begin(), reports.end(), [](const nanomite_simulator::report& r) { return r.removal_cap_reached_us != 0; }))
+    printf("\n* max_removal_ratio prevented further restorations\n");
+
+  if (timeline) {
+    for (size_t i = 0; i < configs.size(); ++i)
+      print_timeline(configs[i].first, reports[i]);
+  }
+  return 0;
+}
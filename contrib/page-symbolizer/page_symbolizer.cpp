@@ -0,0 +1,247 @@
+// Maps per-page statistics of a protected module to the functions located on each page.
+//
+// Usage: page_symbolizer <module> <pages.csv> [--symbols <search path>] [--top <count>] [--by-function]
+//
+// The CSV file contains one page per line, as written from theia::PageStatsEntry:
+//   rva,flags,decrypt_count,reencrypt_count,last_decrypt_ms
+// A leading header line is skipped. Numbers may be decimal or hexadecimal with a 0x prefix.
+#include <Windows.h>
+
+#include <DbgHelp.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+  constexpr uint32_t page_size = 0x1000;
+
+  // from cvconst.h, which is not part of the Windows SDK headers
+  constexpr ULONG sym_tag_function = 5;
+  constexpr ULONG sym_tag_public_symbol = 10;
+
+  // values of theia::THEIA_PAGE_DECRYPTED and theia::THEIA_PAGE_PINNED
+  constexpr uint32_t page_decrypted = 0x1;
+  constexpr uint32_t page_pinned = 0x2;
+
+  struct page_entry {
+    uint32_t rva;
+    uint32_t flags;
+    uint32_t decrypt_count;
+    uint32_t reencrypt_count;
+    uint64_t last_decrypt_ms;
+  };
+
+  struct symbol {
+    uint32_t rva;
+    uint32_t size;
+    bool is_function;
+    std::wstring name;
+  };
+
+  struct collect_context {
+    DWORD64 base;
+    std::vector<symbol>* symbols;
+  };
+
+  bool parse_number(const std::string& text, uint64_t& value) {
+    try {
+      size_t used = 0;
+      value = std::stoull(text, &used, 0);
+      return used == text.size();
+    } catch (...) {
+      return false;
+    }
+  }
+
+  bool read_pages(const wchar_t* path, std::vector<page_entry>& pages) {
+    std::ifstream file(path);
+    if (!file)
+      return false;
+
+    std::string line;
+    for (size_t line_number = 1; std::getline(file, line); ++line_number) {
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      if (line.empty())
+        continue;
+
+      std::vector<uint64_t> fields;
+      std::stringstream stream(line);
+      std::string field;
+      bool valid = true;
+      while (std::getline(stream, field, ',')) {
+        uint64_t value = 0;
+        valid = valid && parse_number(field, value);
+        fields.push_back(value);
+      }
+
+      if (!valid || fields.size() != 5) {
+        if (line_number == 1)
+          continue; // header
+        fwprintf(stderr, L"%s:%zu: expected rva,flags,decrypt_count,reencrypt_count,last_decrypt_ms\n", path, line_number);
+        return false;
+      }
+      pages.push_back(page_entry{
+        static_cast<uint32_t>(fields[0]),
+        static_cast<uint32_t>(fields[1]),
+        static_cast<uint32_t>(fields[2]),
+        static_cast<uint32_t>(fields[3]),
+        fields[4],
+      });
+    }
+    return true;
+  }
+
+  BOOL CALLBACK collect_symbol(PSYMBOL_INFOW info, ULONG size, PVOID user_context) {
+    const auto* context = static_cast<collect_context*>(user_context);
+    if (info->Tag != sym_tag_function && info->Tag != sym_tag_public_symbol)
+      return TRUE;
+
+    context->symbols->push_back(symbol{
+      static_cast<uint32_t>(info->Address - context->base),
+      static_cast<uint32_t>(size != 0 ? size : info->Size),
+      info->Tag == sym_tag_function,
+      std::wstring(info->Name, info->NameLen),
+    });
+    return TRUE;
+  }
+
+  // Sort symbols by RVA, preferring functions over public symbols at the same address, and estimate the size
+  // of symbols without one from the next symbol.
+  void normalize_symbols(std::vector<symbol>& symbols) {
+    std::sort(symbols.begin(), symbols.end(), [](const symbol& a, const symbol& b) {
+      if (a.rva != b.rva)
+        return a.rva < b.rva;
+      return a.is_function && !b.is_function;
+    });
+    symbols.erase(std::unique(symbols.begin(), symbols.end(), [](const symbol& a, const symbol& b) { return a.rva == b.rva; }), symbols.end());
+
+    for (size_t i = 0; i < symbols.size(); ++i) {
+      if (symbols[i].size == 0)
+        symbols[i].size = i + 1 < symbols.size() ? symbols[i + 1].rva - symbols[i].rva : 1;
+    }
+  }
+
+  // Index range of the symbols overlapping the page at `rva`.
+  std::pair<size_t, size_t> symbols_on_page(const std::vector<symbol>& symbols, uint32_t rva) {
+    size_t first = std::upper_bound(symbols.begin(), symbols.end(), rva, [](uint32_t value, const symbol& s) { return value < s.rva; }) - symbols.begin();
+    if (first != 0 && symbols[first - 1].rva + symbols[first - 1].size > rva)
+      --first;
+    size_t last = first;
+    while (last < symbols.size() && symbols[last].rva < rva + page_size)
+      ++last;
+    return {first, last};
+  }
+
+  void print_usage() {
+    fwprintf(stderr, L"usage: page_symbolizer <module> <pages.csv> [--symbols <search path>] [--top <count>] [--by-function]\n");
+  }
+} // namespace
+
+int wmain(int argc, wchar_t** argv) {
+  const wchar_t* module_path = nullptr;
+  const wchar_t* pages_path = nullptr;
+  const wchar_t* search_path = nullptr;
+  size_t top = SIZE_MAX;
+  bool by_function = false;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::wstring arg = argv[i];
+    if (arg == L"--symbols" && i + 1 < argc) {
+      search_path = argv[++i];
+    } else if (arg == L"--top" && i + 1 < argc) {
+      top = wcstoul(argv[++i], nullptr, 0);
+    } else if (arg == L"--by-function") {
+      by_function = true;
+    } else if (module_path == nullptr) {
+      module_path = argv[i];
+    } else if (pages_path == nullptr) {
+      pages_path = argv[i];
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+  if (module_path == nullptr || pages_path == nullptr) {
+    print_usage();
+    return 1;
+  }
+
+  std::vector<page_entry> pages;
+  if (!read_pages(pages_path, pages)) {
+    fwprintf(stderr, L"failed to read %s\n", pages_path);
+    return 1;
+  }
+
+  const HANDLE process = GetCurrentProcess();
+  SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_FAIL_CRITICAL_ERRORS);
+  if (!SymInitializeW(process, search_path, FALSE)) {
+    fwprintf(stderr, L"SymInitialize failed with %lu\n", GetLastError());
+    return 1;
+  }
+
+  const DWORD64 base = SymLoadModuleExW(process, nullptr, module_path, nullptr, 0, 0, nullptr, 0);
+  if (base == 0) {
+    fwprintf(stderr, L"failed to load %s: %lu\n", module_path, GetLastError());
+    SymCleanup(process);
+    return 1;
+  }
+
+  IMAGEHLP_MODULEW64 module_info{};
+  module_info.SizeOfStruct = sizeof(module_info);
+  if (SymGetModuleInfoW64(process, base, &module_info) && module_info.SymType != SymPdb)
+    fwprintf(stderr, L"warning: no PDB found for %s, names are limited to exports\n", module_path);
+
+  std::vector<symbol> symbols;
+  collect_context context{base, &symbols};
+  SymEnumSymbolsW(process, base, L"*", &collect_symbol, &context);
+  SymCleanup(process);
+  normalize_symbols(symbols);
+
+  std::stable_sort(pages.begin(), pages.end(), [](const page_entry& a, const page_entry& b) { return a.decrypt_count > b.decrypt_count; });
+
+  if (by_function) {
+    // a function spanning several pages is charged with the decryptions of all of them
+    std::map<size_t, uint64_t> decrypts;
+    for (const page_entry& page : pages) {
+      const auto range = symbols_on_page(symbols, page.rva);
+      for (size_t i = range.first; i < range.second; ++i)
+        decrypts[i] += page.decrypt_count;
+    }
+
+    std::vector<std::pair<size_t, uint64_t>> sorted(decrypts.begin(), decrypts.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<size_t, uint64_t>& a, const std::pair<size_t, uint64_t>& b) { return a.second > b.second; });
+    wprintf(L"decrypts  rva         size      function\n");
+    for (size_t i = 0; i < sorted.size() && i < top; ++i) {
+      const symbol& s = symbols[sorted[i].first];
+      wprintf(L"%8llu  0x%08x  0x%06x  %s\n", static_cast<unsigned long long>(sorted[i].second), s.rva, s.size, s.name.c_str());
+    }
+    return 0;
+  }
+
+  for (size_t i = 0; i < pages.size() && i < top; ++i) {
+    const page_entry& page = pages[i];
+    wprintf(
+      L"page 0x%08x  decrypts %u  reencrypts %u  last decrypt %llums%s%s\n",
+      page.rva,
+      page.decrypt_count,
+      page.reencrypt_count,
+      static_cast<unsigned long long>(page.last_decrypt_ms),
+      (page.flags & page_decrypted) != 0 ? L"  decrypted" : L"",
+      (page.flags & page_pinned) != 0 ? L"  pinned" : L""
+    );
+
+    const auto range = symbols_on_page(symbols, page.rva);
+    if (range.first == range.second)
+      wprintf(L"    (no symbols)\n");
+    for (size_t j = range.first; j < range.second; ++j)
+      wprintf(L"    0x%08x  0x%06x  %s\n", symbols[j].rva, symbols[j].size, symbols[j].name.c_str());
+  }
+  return 0;
+}
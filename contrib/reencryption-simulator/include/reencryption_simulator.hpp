@@ -0,0 +1,127 @@
+// Offline simulation of page re-encryption policies against recorded page-access traces.
+//
+// A trace lists the page accesses of a protected module over time, along with frame boundaries and calls to
+// Encrypt, PinPages and UnpinPages. The simulator replays it against the re-encryption settings of a runtime
+// configuration and a module configuration, and estimates the decrypt faults, the faults per frame, and the
+// time pages spend decrypted, so that settings can be compared without running the application.
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace reencryption_simulator {
+  // Settings of the `adaptive` object of `periodic_reencryption` in the runtime configuration.
+  struct adaptive_settings {
+    bool enabled = false;
+    double target_fault_rate = 100; // faults per second, or 0 for no target
+    double cpu_budget = 0;          // percent of a core, or 0 for no target
+    uint32_t max_count = 16;
+    uint32_t max_interval_ms = 1000;
+    uint32_t adjustment_period_ms = 1000;
+  };
+
+  // Settings that affect re-encryption, with the defaults of the configuration schemas.
+  struct settings {
+    // `periodic_reencryption` of the runtime configuration
+    bool periodic = true;
+    uint32_t count = 1;
+    uint32_t interval_ms = 16;
+    adaptive_settings adaptive;
+
+    // `frame_scheduling` of the runtime configuration
+    bool frame_scheduling = true;
+    uint32_t max_deferral_ms = 100;
+    uint32_t fallback_timeout_ms = 250;
+
+    // `full_reencryption_threshold` and the RVA ranges of `pinned_pages` of the module configuration
+    double full_reencryption_threshold = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> pinned_ranges;
+
+    // cost model, used for time budgets of Encrypt, idle time budgets and cpu_budget
+    double fault_cost_us = 5;
+    double reencrypt_cost_us = 2;
+
+    // frames with at least this many faults count as bursts
+    uint32_t burst_threshold = 8;
+  };
+
+  enum class event_type {
+    access,      // access <time_us> <rva>
+    frame_begin, // frame <time_us>
+    frame_end,   // idle <time_us> <idle_budget_us>
+    encrypt,     // encrypt <time_us> all|<pages>|<microseconds>us
+    pin,         // pin <time_us> <begin_rva> <end_rva>
+    unpin,       // unpin <time_us> <begin_rva> <end_rva>
+  };
+
+  // Value of `amount` for an encrypt event that re-encrypts all pages, like THEIA_ENCRYPT_ALL.
+  constexpr uint32_t encrypt_all = 0xFFFFFFFF;
+
+  // Flag of `amount` for an encrypt event with a time budget, like THEIA_ENCRYPT_MICROSECONDS.
+  constexpr uint32_t encrypt_microseconds = 0x80000000;
+
+  struct event {
+    uint64_t time_us;
+    event_type type;
+    uint32_t rva;     // access, pin and unpin
+    uint32_t end_rva; // pin and unpin
+    uint32_t amount;  // encrypt: page count or encrypt_all, possibly with encrypt_microseconds; frame_end: idle budget
+  };
+
+  struct trace {
+    // pages eligible for re-encryption, from `pages <begin_rva> <end_rva>` lines, or all accessed pages if
+    // the trace has none
+    std::vector<std::pair<uint32_t, uint32_t>> eligible_ranges;
+    std::vector<event> events;
+  };
+
+  struct report {
+    uint64_t duration_us = 0;
+    uint32_t eligible_pages = 0;
+
+    uint64_t decrypt_faults = 0;
+    double faults_per_second = 0;
+
+    // faults per frame, if the trace has frame events
+    uint64_t frames = 0;
+    double mean_faults_per_frame = 0;
+    uint32_t p99_faults_per_frame = 0;
+    uint32_t max_faults_per_frame = 0;
+    uint64_t burst_frames = 0;
+
+    uint64_t periodic_reencryptions = 0;
+    uint64_t requested_reencryptions = 0;
+    uint64_t full_reencryptions = 0;
+
+    // plaintext exposure, integrated over the eligible pages
+    double plaintext_page_seconds = 0;
+    double mean_plaintext_ratio = 0;
+    double max_plaintext_ratio = 0;
+    double max_plaintext_seconds = 0; // longest time a single page stayed decrypted
+
+    // estimated time spent on decrypt faults and re-encryption, according to the cost model
+    double overhead_ms = 0;
+
+    // settings of periodic re-encryption at the end of the trace, which differ with adaptive re-encryption
+    uint32_t final_count = 0;
+    uint32_t final_interval_ms = 0;
+    uint64_t adjustments = 0;
+  };
+
+  // Read a trace in the text format described above. Lines starting with '#' and empty lines are skipped.
+  // Numbers may be decimal or hexadecimal with a 0x prefix. Events must be ordered by time.
+  bool parse_trace(std::istream& input, trace& output, std::string& error);
+
+  // Apply the options of a runtime configuration to `output`. Options not related to re-encryption are ignored.
+  bool load_runtime_config(const std::string& json, settings& output, std::string& error);
+
+  // Apply the options of a module configuration to `output`. Regular expressions in `pinned_pages` cannot be
+  // resolved without the PDB, and are reported in `warnings`.
+  bool load_module_config(const std::string& json, settings& output, std::vector<std::string>& warnings, std::string& error);
+
+  // Replay `input` against `config`.
+  report simulate(const trace& input, const settings& config);
+} // namespace reencryption_simulator
@@ -0,0 +1,528 @@
+#include "reencryption_simulator.hpp"
+
+#include "config_json.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <set>
+#include <sstream>
+
+namespace reencryption_simulator {
+  namespace {
+    using config_json::json_value;
+    using config_json::parse_number;
+    using config_json::read_number;
+    using config_json::read_object;
+
+    constexpr uint32_t page_size = 0x1000;
+
+    class simulation {
+    public:
+      simulation(const trace& input, const settings& config) : m_trace(input), m_config(config) {}
+
+      report run() {
+        collect_pages();
+        m_result.eligible_pages = static_cast<uint32_t>(m_pages.size());
+        if (m_trace.events.empty() || m_pages.empty())
+          return m_result;
+
+        for (const auto& range : m_config.pinned_ranges)
+          pin(range.first, range.second, 1);
+
+        const uint64_t start = m_trace.events.front().time_us;
+        m_count = m_config.periodic ? (std::max)(m_config.count, 1u) : 0;
+        m_interval_ms = m_config.periodic ? m_config.interval_ms : 0;
+        m_next_tick = start + milliseconds(m_interval_ms != 0 ? m_interval_ms : 16);
+        m_next_adjustment = start + milliseconds(m_config.adaptive.adjustment_period_ms);
+        m_last_adjustment = start;
+        m_last_change = start;
+
+        for (const event& e : m_trace.events) {
+          advance(e.time_us);
+          switch (e.type) {
+            case event_type::access: access(e.rva, e.time_us); break;
+            case event_type::frame_begin: begin_frame(); break;
+            case event_type::frame_end: end_frame(e.time_us, e.amount); break;
+            case event_type::encrypt: encrypt(e.amount, e.time_us); break;
+            case event_type::pin: pin(e.rva, e.end_rva, 1); break;
+            case event_type::unpin: pin(e.rva, e.end_rva, -1); break;
+          }
+        }
+
+        const uint64_t end = m_trace.events.back().time_us;
+        account(end);
+        for (const page& p : m_pages) {
+          if (!p.encrypted)
+            m_result.max_plaintext_seconds = (std::max)(m_result.max_plaintext_seconds, seconds(end - p.decrypted_at));
+        }
+        if (m_in_frame || m_frame_started)
+          m_frame_faults.push_back(m_current_frame_faults);
+
+        m_result.duration_us = end - start;
+        const double duration = seconds(m_result.duration_us);
+        m_result.faults_per_second = duration > 0 ? static_cast<double>(m_result.decrypt_faults) / duration : 0;
+        m_result.mean_plaintext_ratio = duration > 0 ? m_result.plaintext_page_seconds / (duration * static_cast<double>(m_pages.size())) : 0;
+        summarize_frames();
+        m_result.final_count = m_count;
+        m_result.final_interval_ms = m_interval_ms;
+        return m_result;
+      }
+
+    private:
+      struct page {
+        uint32_t rva;
+        bool encrypted = true;
+        uint32_t pins = 0;
+        uint64_t last_access = 0;
+        uint64_t decrypted_at = 0;
+      };
+
+      static uint64_t milliseconds(uint64_t value) {
+        return value * 1000;
+      }
+
+      static double seconds(uint64_t microseconds) {
+        return static_cast<double>(microseconds) / 1e6;
+      }
+
+      void collect_pages() {
+        std::vector<uint32_t> rvas;
+        if (!m_trace.eligible_ranges.empty()) {
+          for (const auto& range : m_trace.eligible_ranges) {
+            for (uint64_t rva = range.first & ~(page_size - 1); rva < range.second; rva += page_size)
+              rvas.push_back(static_cast<uint32_t>(rva));
+          }
+        } else {
+          for (const event& e : m_trace.events) {
+            if (e.type == event_type::access)
+              rvas.push_back(e.rva & ~(page_size - 1));
+          }
+        }
+        std::sort(rvas.begin(), rvas.end());
+        rvas.erase(std::unique(rvas.begin(), rvas.end()), rvas.end());
+        for (uint32_t rva : rvas)
+          m_pages.push_back(page{rva});
+      }
+
+      // Index of the first page at or after the page containing `rva`.
+      size_t lower_bound(uint32_t rva) const {
+        const uint32_t base = rva & ~(page_size - 1);
+        return static_cast<size_t>(std::lower_bound(m_pages.begin(), m_pages.end(), base, [](const page& p, uint32_t value) { return p.rva < value; }) - m_pages.begin());
+      }
+
+      // Index of the page containing `rva`, or the count of pages if it is not eligible.
+      size_t find(uint32_t rva) const {
+        const size_t index = lower_bound(rva);
+        return index != m_pages.size() && m_pages[index].rva == (rva & ~(page_size - 1)) ? index : m_pages.size();
+      }
+
+      // Integrate plaintext exposure up to `now`.
+      void account(uint64_t now) {
+        m_result.plaintext_page_seconds += static_cast<double>(m_decrypted) * seconds(now - m_last_change);
+        m_last_change = now;
+      }
+
+      bool is_candidate(const page& p) const {
+        return !p.encrypted && p.pins == 0;
+      }
+
+      void decrypt(size_t index, uint64_t now) {
+        page& p = m_pages[index];
+        account(now);
+        p.encrypted = false;
+        p.decrypted_at = now;
+        ++m_decrypted;
+        m_result.max_plaintext_ratio = (std::max)(m_result.max_plaintext_ratio, static_cast<double>(m_decrypted) / static_cast<double>(m_pages.size()));
+      }
+
+      void reencrypt(size_t index, uint64_t now) {
+        page& p = m_pages[index];
+        account(now);
+        if (is_candidate(p))
+          m_candidates.erase({p.last_access, index});
+        p.encrypted = true;
+        --m_decrypted;
+        m_result.max_plaintext_seconds = (std::max)(m_result.max_plaintext_seconds, seconds(now - p.decrypted_at));
+        m_result.overhead_ms += m_config.reencrypt_cost_us / 1000;
+        m_period_overhead_us += m_config.reencrypt_cost_us;
+      }
+
+      void access(uint32_t rva, uint64_t now) {
+        const size_t index = find(rva);
+        if (index == m_pages.size())
+          return;
+
+        page& p = m_pages[index];
+        if (is_candidate(p))
+          m_candidates.erase({p.last_access, index});
+        if (p.encrypted) {
+          decrypt(index, now);
+          ++m_result.decrypt_faults;
+          ++m_current_frame_faults;
+          ++m_period_faults;
+          m_result.overhead_ms += m_config.fault_cost_us / 1000;
+          m_period_overhead_us += m_config.fault_cost_us;
+        }
+        p.last_access = now;
+        if (is_candidate(p))
+          m_candidates.insert({p.last_access, index});
+      }
+
+      void pin(uint32_t begin, uint32_t end, int delta) {
+        for (size_t index = lower_bound(begin); index < m_pages.size() && m_pages[index].rva < end; ++index) {
+          page& p = m_pages[index];
+          const bool was_candidate = is_candidate(p);
+          p.pins = delta > 0 ? p.pins + 1 : (p.pins != 0 ? p.pins - 1 : 0);
+          if (was_candidate && !is_candidate(p))
+            m_candidates.erase({p.last_access, index});
+          else if (!was_candidate && is_candidate(p))
+            m_candidates.insert({p.last_access, index});
+        }
+      }
+
+      void begin_frame() {
+        if (m_frame_started)
+          m_frame_faults.push_back(m_current_frame_faults);
+        m_frame_started = true;
+        m_in_frame = true;
+        m_current_frame_faults = 0;
+      }
+
+      void end_frame(uint64_t now, uint32_t idle_budget_us) {
+        m_in_frame = false;
+        m_hinted = true;
+        m_last_frame_end = now;
+        m_idle_deadline = now + idle_budget_us;
+        m_idle_used_us = 0;
+        run_pending(now);
+      }
+
+      void encrypt(uint32_t amount, uint64_t now) {
+        if (amount == encrypt_all) {
+          for (size_t index = 0; index < m_pages.size(); ++index) {
+            if (!m_pages[index].encrypted) {
+              reencrypt(index, now);
+              ++m_result.requested_reencryptions;
+            }
+          }
+          return;
+        }
+
+        uint64_t budget = amount & ~encrypt_microseconds;
+        if ((amount & encrypt_microseconds) != 0)
+          budget = static_cast<uint64_t>(static_cast<double>(budget) / m_config.reencrypt_cost_us);
+        for (size_t visited = 0; visited < m_pages.size() && budget != 0; ++visited) {
+          const size_t index = m_cursor;
+          m_cursor = (m_cursor + 1) % m_pages.size();
+          if (is_candidate(m_pages[index])) {
+            reencrypt(index, now);
+            ++m_result.requested_reencryptions;
+            --budget;
+          }
+        }
+      }
+
+      bool hints_active(uint64_t now) const {
+        return m_config.frame_scheduling && m_hinted && now < m_last_frame_end + milliseconds(m_config.fallback_timeout_ms);
+      }
+
+      // Time at which deferred re-encryption runs regardless of frame hints.
+      uint64_t forced_time() const {
+        return (std::min)(m_pending_since + milliseconds(m_config.max_deferral_ms), m_last_frame_end + milliseconds(m_config.fallback_timeout_ms));
+      }
+
+      // Re-encrypt pending pages, least recently accessed first, as far as frame hints allow.
+      void run_pending(uint64_t now) {
+        if (m_pending == 0)
+          return;
+
+        uint64_t budget = std::numeric_limits<uint64_t>::max();
+        const bool limited = hints_active(now) && now < forced_time();
+        if (limited) {
+          if (m_in_frame || now >= m_idle_deadline)
+            return;
+          const double available = static_cast<double>(m_idle_deadline - now) - m_idle_used_us;
+          budget = available > 0 ? static_cast<uint64_t>(available / m_config.reencrypt_cost_us) : 0;
+        }
+
+        for (; m_pending != 0 && budget != 0; --m_pending, --budget) {
+          if (m_candidates.empty()) {
+            m_pending = 0;
+            break;
+          }
+          reencrypt(m_candidates.begin()->second, now);
+          ++m_result.periodic_reencryptions;
+          if (limited)
+            m_idle_used_us += m_config.reencrypt_cost_us;
+        }
+      }
+
+      // Perform a full re-encryption if more than `full_reencryption_threshold` of the pages are decrypted.
+      void check_full_reencryption(uint64_t now) {
+        if (m_config.full_reencryption_threshold <= 0 || static_cast<double>(m_decrypted) <= m_config.full_reencryption_threshold * static_cast<double>(m_pages.size()))
+          return;
+        for (size_t index = 0; index < m_pages.size(); ++index) {
+          if (!m_pages[index].encrypted)
+            reencrypt(index, now);
+        }
+        ++m_result.full_reencryptions;
+      }
+
+      // Same controller as the adaptive mode of the runtime.
+      void adjust(uint64_t now) {
+        const adaptive_settings& adaptive = m_config.adaptive;
+        const double period = (std::max)(seconds(now - m_last_adjustment), 1e-3);
+        const double fault_rate = static_cast<double>(m_period_faults) / period;
+        const double overhead_rate = m_period_overhead_us / period;
+        m_period_faults = 0;
+        m_period_overhead_us = 0;
+        m_last_adjustment = now;
+
+        const double overhead_budget = adaptive.cpu_budget * 10000;
+        const bool exceeded = (adaptive.target_fault_rate > 0 && fault_rate > adaptive.target_fault_rate) || (adaptive.cpu_budget > 0 && overhead_rate > overhead_budget);
+        const bool below = (adaptive.target_fault_rate <= 0 || fault_rate * 2 <= adaptive.target_fault_rate) && (adaptive.cpu_budget <= 0 || overhead_rate * 2 <= overhead_budget);
+        const uint32_t min_interval = (std::min)(m_config.interval_ms, 16u);
+
+        if (exceeded) {
+          if (m_count > 1)
+            m_count /= 2;
+          else if (m_interval_ms < adaptive.max_interval_ms)
+            m_interval_ms = (std::min)(m_interval_ms * 2, adaptive.max_interval_ms);
+          else
+            return;
+          ++m_result.adjustments;
+        } else if (below) {
+          if (m_interval_ms > min_interval)
+            m_interval_ms = (std::max)(m_interval_ms / 2, min_interval);
+          else if (m_count < adaptive.max_count)
+            ++m_count;
+          else
+            return;
+          ++m_result.adjustments;
+        }
+      }
+
+      // Process ticks, adjustments and deferred re-encryption up to `now`. Deferred re-encryption runs at
+      // the latest at its forced time, which lies after the time it was deferred at, so the loop progresses.
+      void advance(uint64_t now) {
+        const bool adaptive = m_config.periodic && m_config.adaptive.enabled;
+        for (;;) {
+          uint64_t next = m_next_tick;
+          if (adaptive)
+            next = (std::min)(next, m_next_adjustment);
+          if (m_pending != 0)
+            next = (std::min)(next, forced_time());
+          if (next > now)
+            break;
+
+          if (adaptive && next >= m_next_adjustment) {
+            adjust(next);
+            m_next_adjustment = next + milliseconds(m_config.adaptive.adjustment_period_ms);
+          }
+          if (next >= m_next_tick) {
+            if (m_count != 0) {
+              if (m_pending == 0)
+                m_pending_since = next;
+              m_pending += m_count;
+            }
+            // without periodic re-encryption, full re-encryptions are still checked by the periodic task
+            check_full_reencryption(next);
+            m_next_tick = next + milliseconds(m_interval_ms != 0 ? m_interval_ms : 16);
+          }
+          run_pending(next);
+        }
+      }
+
+      void summarize_frames() {
+        m_result.frames = m_frame_faults.size();
+        if (m_frame_faults.empty())
+          return;
+
+        uint64_t total = 0;
+        for (uint32_t faults : m_frame_faults) {
+          total += faults;
+          m_result.burst_frames += faults >= m_config.burst_threshold ? 1 : 0;
+        }
+        std::vector<uint32_t> sorted = m_frame_faults;
+        std::sort(sorted.begin(), sorted.end());
+        m_result.mean_faults_per_frame = static_cast<double>(total) / static_cast<double>(sorted.size());
+        m_result.p99_faults_per_frame = sorted[(sorted.size() - 1) * 99 / 100];
+        m_result.max_faults_per_frame = sorted.back();
+      }
+
+      const trace& m_trace;
+      const settings& m_config;
+      report m_result;
+
+      std::vector<page> m_pages;
+      std::set<std::pair<uint64_t, size_t>> m_candidates; // decrypted, unpinned pages by last access
+      size_t m_decrypted = 0;
+      size_t m_cursor = 0;
+      uint64_t m_last_change = 0;
+
+      uint32_t m_count = 0;
+      uint32_t m_interval_ms = 0;
+      uint64_t m_next_tick = 0;
+      uint64_t m_pending = 0;
+      uint64_t m_pending_since = 0;
+
+      uint64_t m_next_adjustment = 0;
+      uint64_t m_last_adjustment = 0;
+      uint64_t m_period_faults = 0;
+      double m_period_overhead_us = 0;
+
+      bool m_hinted = false;
+      bool m_in_frame = false;
+      bool m_frame_started = false;
+      uint64_t m_last_frame_end = 0;
+      uint64_t m_idle_deadline = 0;
+      double m_idle_used_us = 0;
+      uint32_t m_current_frame_faults = 0;
+      std::vector<uint32_t> m_frame_faults;
+    };
+  } // namespace
+
+  bool parse_trace(std::istream& input, trace& output, std::string& error) {
+    std::string line;
+    uint64_t last_time = 0;
+    for (size_t line_number = 1; std::getline(input, line); ++line_number) {
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      if (line.empty() || line[0] == '#')
+        continue;
+
+      std::istringstream stream(line);
+      std::string kind;
+      std::vector<std::string> fields;
+      stream >> kind;
+      for (std::string field; stream >> field;)
+        fields.push_back(field);
+
+      const auto fail = [&](const char* expected) {
+        error = "line " + std::to_string(line_number) + ": expected '" + expected + "'";
+        return false;
+      };
+
+      uint64_t values[3] = {};
+      if (kind == "pages") {
+        if (fields.size() != 2 || !parse_number(fields[0], values[0]) || !parse_number(fields[1], values[1]) || values[1] > UINT32_MAX)
+          return fail("pages <begin_rva> <end_rva>");
+        output.eligible_ranges.emplace_back(static_cast<uint32_t>(values[0]), static_cast<uint32_t>(values[1]));
+        continue;
+      }
+
+      event e{};
+      if (kind == "access") {
+        if (fields.size() != 2 || !parse_number(fields[0], values[0]) || !parse_number(fields[1], values[1]) || values[1] > UINT32_MAX)
+          return fail("access <time_us> <rva>");
+        e = event{values[0], event_type::access, static_cast<uint32_t>(values[1]), 0, 0};
+      } else if (kind == "frame") {
+        if (fields.size() != 1 || !parse_number(fields[0], values[0]))
+          return fail("frame <time_us>");
+        e = event{values[0], event_type::frame_begin, 0, 0, 0};
+      } else if (kind == "idle") {
+        if (fields.size() != 2 || !parse_number(fields[0], values[0]) || !parse_number(fields[1], values[1]) || values[1] > UINT32_MAX)
+          return fail("idle <time_us> <idle_budget_us>");
+        e = event{values[0], event_type::frame_end, 0, 0, static_cast<uint32_t>(values[1])};
+      } else if (kind == "encrypt") {
+        if (fields.size() != 2 || !parse_number(fields[0], values[0]))
+          return fail("encrypt <time_us> all|<pages>|<microseconds>us");
+        std::string amount = fields[1];
+        uint32_t flags = 0;
+        if (amount.size() > 2 && amount.compare(amount.size() - 2, 2, "us") == 0) {
+          amount.resize(amount.size() - 2);
+          flags = encrypt_microseconds;
+        }
+        if (amount == "all" && flags == 0) {
+          values[1] = encrypt_all;
+        } else if (!parse_number(amount, values[1]) || values[1] >= encrypt_microseconds - 1) {
+          return fail("encrypt <time_us> all|<pages>|<microseconds>us");
+        }
+        e = event{values[0], event_type::encrypt, 0, 0, static_cast<uint32_t>(values[1]) | flags};
+      } else if (kind == "pin" || kind == "unpin") {
+        if (fields.size() != 3 || !parse_number(fields[0], values[0]) || !parse_number(fields[1], values[1]) || !parse_number(fields[2], values[2]) ||
+            values[1] > UINT32_MAX || values[2] > UINT32_MAX)
+          return fail("pin|unpin <time_us> <begin_rva> <end_rva>");
+        e = event{values[0], kind == "pin" ? event_type::pin : event_type::unpin, static_cast<uint32_t>(values[1]), static_cast<uint32_t>(values[2]), 0};
+      } else {
+        error = "line " + std::to_string(line_number) + ": unknown event '" + kind + "'";
+        return false;
+      }
+
+      if (e.time_us < last_time) {
+        error = "line " + std::to_string(line_number) + ": events must be ordered by time";
+        return false;
+      }
+      last_time = e.time_us;
+      output.events.push_back(e);
+    }
+    return true;
+  }
+
+  bool load_runtime_config(const std::string& json, settings& output, std::string& error) {
+    json_value root;
+    if (!read_object(json, root, error))
+      return false;
+
+    if (const json_value* periodic = root.find("periodic_reencryption")) {
+      output.periodic = periodic->type == json_value::kind::object;
+      if (output.periodic && (!read_number(*periodic, "count", output.count, error) || !read_number(*periodic, "interval", output.interval_ms, error)))
+        return false;
+
+      const json_value* adaptive = output.periodic ? periodic->find("adaptive") : nullptr;
+      output.adaptive.enabled = adaptive != nullptr && adaptive->type == json_value::kind::object;
+      if (output.adaptive.enabled) {
+        adaptive_settings& target = output.adaptive;
+        const json_value* fault_rate = adaptive->find("target_fault_rate");
+        const json_value* cpu_budget = adaptive->find("cpu_budget");
+        if (fault_rate != nullptr && fault_rate->type == json_value::kind::null)
+          target.target_fault_rate = 0;
+        else if (!read_number(*adaptive, "target_fault_rate", target.target_fault_rate, error))
+          return false;
+        if (cpu_budget != nullptr && cpu_budget->type != json_value::kind::null && !read_number(*adaptive, "cpu_budget", target.cpu_budget, error))
+          return false;
+        if (!read_number(*adaptive, "max_count", target.max_count, error) || !read_number(*adaptive, "max_interval", target.max_interval_ms, error) ||
+            !read_number(*adaptive, "adjustment_period", target.adjustment_period_ms, error))
+          return false;
+      }
+    }
+
+    if (const json_value* scheduling = root.find("frame_scheduling")) {
+      output.frame_scheduling = scheduling->type == json_value::kind::object;
+      if (output.frame_scheduling &&
+          (!read_number(*scheduling, "max_deferral", output.max_deferral_ms, error) || !read_number(*scheduling, "fallback_timeout", output.fallback_timeout_ms, error)))
+        return false;
+    }
+    return true;
+  }
+
+  bool load_module_config(const std::string& json, settings& output, std::vector<std::string>& warnings, std::string& error) {
+    json_value root;
+    if (!read_object(json, root, error))
+      return false;
+
+    if (!read_number(root, "full_reencryption_threshold", output.full_reencryption_threshold, error))
+      return false;
+
+    if (const json_value* pinned = root.find("pinned_pages")) {
+      for (const json_value& item : pinned->array) {
+        if (item.type == json_value::kind::string) {
+          warnings.push_back("pinned_pages: regular expression '" + item.string + "' requires the PDB and is ignored, use an RVA range instead");
+          continue;
+        }
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        if (!read_number(item, "start_rva", begin, error) || !read_number(item, "end_rva", end, error))
+          return false;
+        output.pinned_ranges.emplace_back(static_cast<uint32_t>(begin), static_cast<uint32_t>(end));
+      }
+    }
+    return true;
+  }
+
+  report simulate(const trace& input, const settings& config) {
+    return simulation(input, config).run();
+  }
+} // namespace reencryption_simulator
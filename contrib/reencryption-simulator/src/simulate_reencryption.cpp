@@ -0,0 +1,124 @@
+// Replays a recorded page-access trace against one or more runtime configurations, and compares the
+// expected decrypt faults, faults per frame and plaintext exposure.
+//
+// Usage: simulate_reencryption <trace> [--runtime-config <json>]... [--module-config <json>]
+//                              [--fault-cost-us <us>] [--reencrypt-cost-us <us>] [--burst <faults>]
+//
+// Each runtime configuration is simulated separately and printed as one row. Without any, the defaults of
+// the runtime configuration schema are simulated.
+#include "reencryption_simulator.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+  bool read_file(const char* path, std::string& contents) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+    std::ostringstream stream;
+    stream << file.rdbuf();
+    contents = stream.str();
+    return true;
+  }
+
+  void print_usage() {
+    fprintf(stderr,
+            "usage: simulate_reencryption <trace> [--runtime-config <json>]... [--module-config <json>]\n"
+            "                             [--fault-cost-us <us>] [--reencrypt-cost-us <us>] [--burst <faults>]\n");
+  }
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* trace_path = nullptr;
+  const char* module_path = nullptr;
+  std::vector<const char*> runtime_paths;
+  reencryption_simulator::settings base;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--runtime-config" && i + 1 < argc) {
+      runtime_paths.push_back(argv[++i]);
+    } else if (arg == "--module-config" && i + 1 < argc) {
+      module_path = argv[++i];
+    } else if (arg == "--fault-cost-us" && i + 1 < argc) {
+      base.fault_cost_us = strtod(argv[++i], nullptr);
+    } else if (arg == "--reencrypt-cost-us" && i + 1 < argc) {
+      base.reencrypt_cost_us = strtod(argv[++i], nullptr);
+    } else if (arg == "--burst" && i + 1 < argc) {
+      base.burst_threshold = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+    } else if (trace_path == nullptr && arg[0] != '-') {
+      trace_path = argv[i];
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+  if (trace_path == nullptr || base.reencrypt_cost_us <= 0 || base.fault_cost_us < 0) {
+    print_usage();
+    return 1;
+  }
+
+  std::string error;
+  reencryption_simulator::trace trace;
+  std::ifstream trace_file(trace_path);
+  if (!trace_file || !reencryption_simulator::parse_trace(trace_file, trace, error)) {
+    fprintf(stderr, "failed to read %s: %s\n", trace_path, trace_file ? error.c_str() : "cannot open file");
+    return 1;
+  }
+
+  if (module_path != nullptr) {
+    std::string contents;
+    std::vector<std::string> warnings;
+    if (!read_file(module_path, contents) || !reencryption_simulator::load_module_config(contents, base, warnings, error)) {
+      fprintf(stderr, "failed to read %s: %s\n", module_path, error.empty() ? "cannot open file" : error.c_str());
+      return 1;
+    }
+    for (const std::string& warning : warnings)
+      fprintf(stderr, "warning: %s\n", warning.c_str());
+  }
+
+  std::vector<std::pair<std::string, reencryption_simulator::settings>> configs;
+  for (const char* path : runtime_paths) {
+    std::string contents;
+    reencryption_simulator::settings config = base;
+    if (!read_file(path, contents) || !reencryption_simulator::load_runtime_config(contents, config, error)) {
+      fprintf(stderr, "failed to read %s: %s\n", path, error.empty() ? "cannot open file" : error.c_str());
+      return 1;
+    }
+    configs.emplace_back(path, config);
+  }
+  if (configs.empty())
+    configs.emplace_back("defaults", base);
+
+  bool printed_header = false;
+  for (const auto& config : configs) {
+    const reencryption_simulator::report r = reencryption_simulator::simulate(trace, config.second);
+    if (!printed_header) {
+      printf("%zu events over %.1f s, %u eligible pages, %llu frames\n\n", trace.events.size(), static_cast<double>(r.duration_us) / 1e6, r.eligible_pages,
+             static_cast<unsigned long long>(r.frames));
+      printf("%-24s %9s %8s %20s %7s %17s %9s %20s %9s %10s\n", "config", "faults", "faults/s", "faults/frame avg/p99/max", "bursts", "plaintext avg/max",
+             "longest", "re-encrypted p/r/f", "overhead", "count/int");
+      printed_header = true;
+    }
+
+    char per_frame[64];
+    snprintf(per_frame, sizeof(per_frame), "%.2f/%u/%u", r.mean_faults_per_frame, r.p99_faults_per_frame, r.max_faults_per_frame);
+    char plaintext[64];
+    snprintf(plaintext, sizeof(plaintext), "%.1f%%/%.1f%%", r.mean_plaintext_ratio * 100, r.max_plaintext_ratio * 100);
+    char reencrypted[64];
+    snprintf(reencrypted, sizeof(reencrypted), "%llu/%llu/%llu", static_cast<unsigned long long>(r.periodic_reencryptions),
+             static_cast<unsigned long long>(r.requested_reencryptions), static_cast<unsigned long long>(r.full_reencryptions));
+    char settings[64];
+    snprintf(settings, sizeof(settings), "%u/%ums", r.final_count, r.final_interval_ms);
+
+    printf("%-24s %9llu %8.1f %20s %7llu %17s %8.2fs %20s %7.1fms %10s\n", config.first.c_str(), static_cast<unsigned long long>(r.decrypt_faults),
+           r.faults_per_second, per_frame, static_cast<unsigned long long>(r.burst_frames), plaintext, r.max_plaintext_seconds, reencrypted, r.overhead_ms,
+           settings);
+  }
+  return 0;
+}
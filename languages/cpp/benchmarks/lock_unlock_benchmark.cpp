@@ -0,0 +1,73 @@
+/// @file lock_unlock_benchmark.cpp
+/// @copyright Copyright (C) Zero IT Lab - All Rights Reserved
+/// @brief Measures lock/unlock latency of the Linux stand-in heap against its reserved size.
+///
+/// Unauthorized copying of this file, via any medium is strictly prohibited
+/// Proprietary and confidential
+#include "theia_standin_heap.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+THEIA_ONCE();
+
+namespace {
+  constexpr size_t kFrames = 2000;
+  constexpr size_t kTouchedPerFrame = 16;
+  constexpr size_t kAllocationSize = 0x10000;
+
+  using Clock = std::chrono::steady_clock;
+
+  // Fills a quarter of a heap of the given size with 64kB allocations, then runs frames which each enter
+  // the critical section, touch `kTouchedPerFrame` random allocations, and leave the critical section.
+  void Run(size_t ReservedSize) {
+    theia::Heap* Heap = theia::GetInterface()->CreateHeap(ReservedSize, 0, nullptr);
+    theia::StandInHeap* StandIn = theia::StandInHeap::FromHeap(Heap);
+    if (StandIn == nullptr) {
+      printf("%6zu MiB: not running on the stand-in heap\n", ReservedSize >> 20);
+      return;
+    }
+
+    std::vector<volatile uint8_t*> Live;
+    Heap->lock();
+    while (Live.size() * kAllocationSize < ReservedSize / 4) {
+      auto* Pointer = static_cast<volatile uint8_t*>(Heap->Allocate(kAllocationSize - 64));
+      if (Pointer == nullptr)
+        break;
+      for (size_t Offset = 0; Offset < kAllocationSize - 64; Offset += 0x1000)
+        Pointer[Offset] = 1;
+      Live.push_back(Pointer);
+    }
+    Heap->unlock();
+
+    std::mt19937 Random(42);
+    std::uniform_int_distribution<size_t> Distribution(0, Live.size() - 1);
+    const theia::StandInHeap::Counters Before = StandIn->GetCounters();
+
+    const auto Start = Clock::now();
+    for (size_t Frame = 0; Frame < kFrames; ++Frame) {
+      Heap->lock();
+      for (size_t i = 0; i < kTouchedPerFrame; ++i)
+        ++*Live[Distribution(Random)];
+      Heap->unlock();
+    }
+    const auto End = Clock::now();
+
+    const theia::StandInHeap::Counters After = StandIn->GetCounters();
+    const double FrameNs = std::chrono::duration<double, std::nano>(End - Start).count() / kFrames;
+    printf("%6zu MiB reserved, %6zu MiB committed: lock %8.0f ns, unlock %8.0f ns, frame %8.0f ns\n", ReservedSize >> 20, StandIn->GetCommittedSize() >> 20,
+           static_cast<double>(After.LockNanoseconds - Before.LockNanoseconds) / kFrames,
+           static_cast<double>(After.UnlockNanoseconds - Before.UnlockNanoseconds) / kFrames, FrameNs);
+
+    Heap->Destroy();
+  }
+} // namespace
+
+int main() {
+  printf("%zu allocations touched per frame\n", kTouchedPerFrame);
+  for (size_t ReservedSize = size_t(1) << 20; ReservedSize <= size_t(1) << 30; ReservedSize <<= 2)
+    Run(ReservedSize);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/// @file page_encryption_benchmark.cpp
+/// @copyright Copyright (C) Zero IT Lab - All Rights Reserved
+/// @brief Measures frame times under emulated page encryption against periodic re-encryption settings.
+///
+/// Unauthorized copying of this file, via any medium is strictly prohibited
+/// Proprietary and confidential
+#include "theia_emulator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+THEIA_ONCE();
+
+// each function occupies its own page of a dedicated section, which is encrypted by the emulator. The line
+// number keeps the functions distinct, so that the compiler does not fold them.
+#define BENCHMARK_FUNCTION(Name)                                                                                  \
+  __attribute__((section("theia_benchmark"), aligned(4096), noinline)) uint64_t Work##Name(uint64_t Value) { \
+    for (int i = 0; i < 64; ++i)                                                                                  \
+      Value = Value * 6364136223846793005ull + __LINE__;                                                          \
+    return Value;                                                                                                 \
+  }
+
+BENCHMARK_FUNCTION(0)
+BENCHMARK_FUNCTION(1)
+BENCHMARK_FUNCTION(2)
+BENCHMARK_FUNCTION(3)
+BENCHMARK_FUNCTION(4)
+BENCHMARK_FUNCTION(5)
+BENCHMARK_FUNCTION(6)
+BENCHMARK_FUNCTION(7)
+BENCHMARK_FUNCTION(8)
+BENCHMARK_FUNCTION(9)
+BENCHMARK_FUNCTION(10)
+BENCHMARK_FUNCTION(11)
+BENCHMARK_FUNCTION(12)
+BENCHMARK_FUNCTION(13)
+BENCHMARK_FUNCTION(14)
+BENCHMARK_FUNCTION(15)
+
+// the emulator only encrypts whole pages, and the page of the last function is only partially used
+BENCHMARK_FUNCTION(Unused)
+
+extern "C" char __start_theia_benchmark[];
+extern "C" char __stop_theia_benchmark[];
+
+namespace {
+  constexpr size_t kFrames = 2000;
+  constexpr size_t kHotFunctions = 8;
+  constexpr size_t kColdInterval = 16;
+  constexpr auto kFrameTime = std::chrono::microseconds(500);
+
+  using Clock = std::chrono::steady_clock;
+  using WorkType = uint64_t(uint64_t);
+
+  WorkType* const kFunctions[] = {Work0, Work1, Work2,  Work3,  Work4,  Work5,  Work6,  Work7,
+                                  Work8, Work9, Work10, Work11, Work12, Work13, Work14, Work15};
+  constexpr size_t kFunctionCount = sizeof(kFunctions) / sizeof(kFunctions[0]);
+
+  // Runs frames which each call the first `kHotFunctions` functions, and every `kColdInterval` frames one of
+  // the others in turn, then wait for the rest of the frame time, so that periodic re-encryption may run
+  // between frames like in a game. With `Hints`, the idle time is reported to the runtime through FrameEnd.
+  void Run(const char* Name, uint32_t Interval, uint32_t Count, bool Pin, bool Hints) {
+    theia::Emulator::Options Config;
+    Config.ReencryptionInterval = Interval;
+    Config.ReencryptionCount = Count;
+    if (!theia::Emulator::Install(Config) || theia::Emulator::AddRange(__start_theia_benchmark, __stop_theia_benchmark) == 0) {
+      printf("%-28s: failed to install the emulator\n", Name);
+      theia::Emulator::Uninstall();
+      return;
+    }
+    const theia::FunctionPtrs* Interface = theia::GetInterface();
+    if (Pin)
+      Interface->PinPages(reinterpret_cast<const void*>(kFunctions[0]), reinterpret_cast<const char*>(kFunctions[kHotFunctions - 1]) + 1);
+
+    std::vector<double> FrameNs;
+    FrameNs.reserve(kFrames);
+    volatile uint64_t Sink = 0;
+    theia::LatencyStats Latency{};
+    Latency.BufferSize = sizeof(Latency);
+    Interface->QueryLatencyStats(&Latency, true);
+
+    for (size_t Frame = 0; Frame < kFrames; ++Frame) {
+      const auto Start = Clock::now();
+      if (Hints)
+        Interface->FrameBegin();
+      uint64_t Value = Frame;
+      for (size_t i = 0; i < kHotFunctions; ++i)
+        Value = kFunctions[i](Value);
+      if (Frame % kColdInterval == 0)
+        Value = kFunctions[kHotFunctions + Frame / kColdInterval % (kFunctionCount - kHotFunctions)](Value);
+      Sink = Value;
+      const auto End = Clock::now();
+      FrameNs.push_back(std::chrono::duration<double, std::nano>(End - Start).count());
+      if (Hints)
+        Interface->FrameEnd(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Start + kFrameTime - End).count()));
+      while (Clock::now() - Start < kFrameTime) {
+      }
+    }
+    (void)Sink;
+
+    Interface->QueryLatencyStats(&Latency, false);
+    std::sort(FrameNs.begin(), FrameNs.end());
+    double Total = 0;
+    for (double Value : FrameNs)
+      Total += Value;
+    printf("%-28s: frame mean %8.0f ns, p99 %8.0f ns, max %8.0f ns, %6llu faults, fault p99 %6llu ns\n", Name, Total / kFrames,
+           FrameNs[kFrames * 99 / 100], FrameNs.back(), static_cast<unsigned long long>(Latency.DecryptFaults.Count),
+           static_cast<unsigned long long>(theia::EstimatePercentile(Latency.DecryptFaults, 0.99)));
+    theia::Emulator::Uninstall();
+  }
+} // namespace
+
+int main() {
+  printf("%zu hot functions called per frame, 1 cold function every %zu frames\n", kHotFunctions, kColdInterval);
+  Run("no re-encryption", 0, 0, false, false);
+  Run("1 page every 16 ms", 16, 1, false, false);
+  Run("4 pages every 16 ms", 16, 4, false, false);
+  Run("4 pages every 4 ms", 4, 4, false, false);
+  Run("4 pages every 4 ms, pinned", 4, 4, true, false);
+  Run("4 pages every 4 ms, hinted", 4, 4, false, true);
+  return 0;
+}
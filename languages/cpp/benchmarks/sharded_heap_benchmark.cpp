@@ -0,0 +1,126 @@
+/// @file sharded_heap_benchmark.cpp
+/// @copyright Copyright (C) Zero IT Lab - All Rights Reserved
+/// @brief Measures how theia::ShardedHeap scales with the amount of threads.
+///
+/// Unauthorized copying of this file, via any medium is strictly prohibited
+/// Proprietary and confidential
+#include "theia_heap.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+THEIA_ONCE();
+
+namespace {
+  constexpr size_t kIterationsPerThread = 20000;
+  constexpr size_t kAllocationsPerIteration = 32;
+  constexpr size_t kMailboxSize = 1024;
+  constexpr size_t kMaxThreads = 32;
+
+  // Hands every eighth allocation to a random other thread, which will free it later. This produces a
+  // steady amount of cross-shard frees.
+  std::atomic<void*> g_Mailbox[kMailboxSize];
+
+  // The pattern the ShardedHeap replaces: a single heap shared by all threads, serialized by a mutex.
+  class MutexGuardedHeap {
+  public:
+    explicit MutexGuardedHeap(theia::Heap* Heap)
+      : m_Heap(Heap) {}
+
+    void lock() {
+      m_Mutex.lock();
+      m_Heap->lock();
+    }
+
+    void unlock() {
+      m_Heap->unlock();
+      m_Mutex.unlock();
+    }
+
+    void* Allocate(size_t Size) {
+      return m_Heap->Allocate(Size);
+    }
+
+    bool DeAllocate(void* Pointer) {
+      return m_Heap->DeAllocate(Pointer);
+    }
+
+  private:
+    theia::Heap* m_Heap;
+    std::mutex m_Mutex;
+  };
+
+  template <typename HeapType>
+  void Worker(HeapType* Heap, size_t Seed) {
+    std::mt19937 Random(static_cast<uint32_t>(Seed));
+    std::uniform_int_distribution<size_t> Sizes(16, 256);
+    std::uniform_int_distribution<size_t> Slots(0, kMailboxSize - 1);
+    void* Previous[kAllocationsPerIteration]{};
+
+    for (size_t Iteration = 0; Iteration < kIterationsPerThread; ++Iteration) {
+      std::lock_guard<HeapType> Guard(*Heap);
+      for (size_t i = 0; i < kAllocationsPerIteration; ++i) {
+        void* Pointer = Previous[i];
+        if (i % 8 == 0)
+          Pointer = g_Mailbox[Slots(Random)].exchange(Pointer);
+        Heap->DeAllocate(Pointer);
+
+        Previous[i] = Heap->Allocate(Sizes(Random));
+        *static_cast<volatile uint8_t*>(Previous[i]) = 1;
+      }
+    }
+
+    std::lock_guard<HeapType> Guard(*Heap);
+    for (void* Pointer : Previous)
+      Heap->DeAllocate(Pointer);
+  }
+
+  template <typename HeapType>
+  double Run(HeapType* Heap, size_t ThreadCount) {
+    std::vector<std::thread> Threads;
+    const auto Start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ThreadCount; ++i)
+      Threads.emplace_back(Worker<HeapType>, Heap, i);
+    for (std::thread& Thread : Threads)
+      Thread.join();
+    const auto End = std::chrono::steady_clock::now();
+
+    std::lock_guard<HeapType> Guard(*Heap);
+    for (std::atomic<void*>& Slot : g_Mailbox)
+      Heap->DeAllocate(Slot.exchange(nullptr));
+
+    const double Seconds = std::chrono::duration<double>(End - Start).count();
+    return ThreadCount * kIterationsPerThread * kAllocationsPerIteration / Seconds / 1e6;
+  }
+} // namespace
+
+int main(int argc, char** argv) {
+  // optional first argument: amount of shards, defaults to one per hardware thread
+  const size_t ShardCount = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 0;
+
+  theia::Heap* Single = theia::GetInterface()->CreateHeap(0x10000000, 0, nullptr);
+  MutexGuardedHeap Guarded(Single);
+  theia::ShardedHeap* Sharded = theia::ShardedHeap::Create(ShardCount, 0x4000000, 0);
+  if (Sharded == nullptr) {
+    puts("failed to create sharded heap");
+    return 1;
+  }
+
+  printf("protected: %s, hardware threads: %u, shards: %zu\n", theia::GetInterface()->IsProtected() ? "yes" : "no", std::thread::hardware_concurrency(), Sharded->GetShardCount());
+  printf("%8s %24s %24s\n", "threads", "mutex + Heap [Mops/s]", "ShardedHeap [Mops/s]");
+  for (size_t ThreadCount = 1; ThreadCount <= kMaxThreads; ThreadCount *= 2) {
+    const double GuardedThroughput = Run(&Guarded, ThreadCount);
+    const double ShardedThroughput = Run(Sharded, ThreadCount);
+    printf("%8zu %24.2f %24.2f\n", ThreadCount, GuardedThroughput, ShardedThroughput);
+  }
+
+  Sharded->Destroy();
+  Single->Destroy();
+  return 0;
+}
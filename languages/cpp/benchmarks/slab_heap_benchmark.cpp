@@ -0,0 +1,136 @@
+/// @file slab_heap_benchmark.cpp
+/// @copyright Copyright (C) Zero IT Lab - All Rights Reserved
+/// @brief Compares theia::SlabHeap against raw theia::Heap allocations.
+///
+/// Unauthorized copying of this file, via any medium is strictly prohibited
+/// Proprietary and confidential
+#include "theia_heap.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <vector>
+
+THEIA_ONCE();
+
+namespace {
+  constexpr size_t kFrames = 500;
+  constexpr size_t kAllocationsPerFrame = 4096;
+  constexpr size_t kFramesAlive = 4;
+
+  using Clock = std::chrono::steady_clock;
+
+  double NanosecondsPerOperation(Clock::time_point Start, Clock::time_point End) {
+    return std::chrono::duration<double, std::nano>(End - Start).count() / (kFrames * kAllocationsPerFrame);
+  }
+
+  // Simulates long-lived entities: every frame spawns a batch of 16 to 256 byte objects inside the
+  // critical section, and frees the batch spawned `kFramesAlive` frames ago.
+  double RunSteady(theia::Heap* Heap, const std::vector<size_t>& Sizes) {
+    std::vector<void*> Live(kAllocationsPerFrame * kFramesAlive, nullptr);
+
+    const auto Start = Clock::now();
+    for (size_t Frame = 0; Frame < kFrames; ++Frame) {
+      std::lock_guard<theia::Heap> Guard(*Heap);
+
+      void** Batch = &Live[(Frame % kFramesAlive) * kAllocationsPerFrame];
+      for (size_t i = 0; i < kAllocationsPerFrame; ++i) {
+        Heap->DeAllocate(Batch[i]);
+        Batch[i] = Heap->Allocate(Sizes[i]);
+        *static_cast<volatile uint8_t*>(Batch[i]) = 1;
+      }
+    }
+    const auto End = Clock::now();
+
+    std::lock_guard<theia::Heap> Guard(*Heap);
+    for (void* Pointer : Live)
+      Heap->DeAllocate(Pointer);
+
+    return NanosecondsPerOperation(Start, End);
+  }
+
+  // Simulates short-lived particles: every frame allocates a batch of 16 to 256 byte objects, and frees
+  // all of them again before leaving the critical section.
+  double RunBurst(theia::Heap* Heap, const std::vector<size_t>& Sizes) {
+    std::vector<void*> Live(kAllocationsPerFrame, nullptr);
+
+    const auto Start = Clock::now();
+    for (size_t Frame = 0; Frame < kFrames; ++Frame) {
+      std::lock_guard<theia::Heap> Guard(*Heap);
+
+      for (size_t i = 0; i < kAllocationsPerFrame; ++i) {
+        Live[i] = Heap->Allocate(Sizes[i]);
+        *static_cast<volatile uint8_t*>(Live[i]) = 1;
+      }
+      for (size_t i = 0; i < kAllocationsPerFrame; ++i)
+        Heap->DeAllocate(Live[i]);
+    }
+    const auto End = Clock::now();
+
+    return NanosecondsPerOperation(Start, End);
+  }
+
+  // Simulates unloading a level: every frame allocates a batch of 16 to 256 byte objects, and tears
+  // all of them down at once, either with separate DeAllocate calls or with a single DeAllocateBatch.
+  double RunTeardown(theia::Heap* Heap, const std::vector<size_t>& Sizes, bool Batched) {
+    std::vector<void*> Live(kAllocationsPerFrame, nullptr);
+
+    Clock::duration Elapsed{};
+    for (size_t Frame = 0; Frame < kFrames; ++Frame) {
+      std::lock_guard<theia::Heap> Guard(*Heap);
+
+      for (size_t i = 0; i < kAllocationsPerFrame; ++i) {
+        Live[i] = Heap->Allocate(Sizes[i]);
+        *static_cast<volatile uint8_t*>(Live[i]) = 1;
+      }
+
+      const auto Start = Clock::now();
+      if (Batched) {
+        Heap->DeAllocateBatch(Live.data(), Live.size());
+      } else {
+        for (void* Pointer : Live)
+          Heap->DeAllocate(Pointer);
+      }
+      Elapsed += Clock::now() - Start;
+    }
+
+    return std::chrono::duration<double, std::nano>(Elapsed).count() / (kFrames * kAllocationsPerFrame);
+  }
+
+  void Report(const char* Scenario, double RawNs, double SlabNs) {
+    printf("%-8s %-18s %10.2f ns per allocate+free\n", Scenario, "theia::Heap", RawNs);
+    printf("%-8s %-18s %10.2f ns per allocate+free (%.2fx)\n", Scenario, "theia::SlabHeap", SlabNs, RawNs / SlabNs);
+  }
+} // namespace
+
+int main() {
+  std::mt19937 Random(42);
+  std::uniform_int_distribution<size_t> Distribution(16, 256);
+  std::vector<size_t> Sizes(kAllocationsPerFrame);
+  for (size_t& Size : Sizes)
+    Size = Distribution(Random);
+
+  theia::Heap* Raw = theia::GetInterface()->CreateHeap(0x4000000, 0, nullptr);
+  theia::Heap* Slab = theia::SlabHeap::Create(Raw);
+
+  // warm up both heaps once so that chunk allocation is not part of the measurement
+  RunSteady(Slab, Sizes);
+  RunSteady(Raw, Sizes);
+
+  printf("protected: %s\n", theia::GetInterface()->IsProtected() ? "yes" : "no");
+  Report("steady", RunSteady(Raw, Sizes), RunSteady(Slab, Sizes));
+  Report("burst", RunBurst(Raw, Sizes), RunBurst(Slab, Sizes));
+
+  for (theia::Heap* Heap : {Raw, Slab}) {
+    const char* Name = Heap == Raw ? "theia::Heap" : "theia::SlabHeap";
+    const double LoopNs = RunTeardown(Heap, Sizes, false);
+    const double BatchNs = RunTeardown(Heap, Sizes, true);
+    printf("%-8s %-18s %10.2f ns per free (loop)\n", "teardown", Name, LoopNs);
+    printf("%-8s %-18s %10.2f ns per free (batch, %.2fx)\n", "teardown", Name, BatchNs, LoopNs / BatchNs);
+  }
+
+  Slab->Destroy();
+  Raw->Destroy();
+  return 0;
+}
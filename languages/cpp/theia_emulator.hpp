@@ -0,0 +1,955 @@
+/// @file theia_emulator.hpp
+/// @copyright Copyright (C) Zero IT Lab - All Rights Reserved
+/// @brief Emulation of the page encryption of the Theia runtime in unprotected processes on Linux.
+///
+/// Unauthorized copying of this file, via any medium is strictly prohibited
+/// Proprietary and confidential
+#pragma once
+
+#if !defined(__linux__)
+#error "The Theia runtime emulator is only available on Linux"
+#endif
+
+// the emulator serves heaps from the stand-in heap, which the default implementations use if this is defined
+#if defined(THEIA_SDK_STANDIN_HEAP) && !THEIA_SDK_STANDIN_HEAP
+#error "theia_sdk.hpp was included without THEIA_STANDIN_HEAP; include theia_emulator.hpp first or define THEIA_STANDIN_HEAP"
+#endif
+#if !defined(THEIA_STANDIN_HEAP)
+#define THEIA_STANDIN_HEAP
+#endif
+#include "theia_standin_heap.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <link.h>
+#include <mutex>
+#include <new>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+namespace THEIA_REAL_NAMESPACE {
+  /// @brief Emulation of the Theia runtime in unprotected processes on Linux.
+  ///
+  /// Unprotected builds use the no-op defaults of @c THEIA_ONCE, so they do not pay for decrypting pages on
+  /// first use, or for re-encrypting them later. The emulator replaces the interface returned by
+  /// @c GetInterface with one that emulates this overhead for chosen ranges of code or data, which allows
+  /// benchmarking the cost of page encryption and tuning re-encryption settings without packing:
+  ///
+  /// - Pages added through @c AddRange are encrypted and made inaccessible using @c mprotect.
+  /// - Accessing an encrypted page faults. A @c SIGSEGV handler decrypts the page and restores its protection.
+  /// - A worker thread periodically re-encrypts decrypted pages, like the `periodic_reencryption` option of the
+  ///   runtime configuration, and processes requests of @c FunctionPtrs::EncryptAsync. Given frame hints through
+  ///   @c FunctionPtrs::FrameBegin and @c FunctionPtrs::FrameEnd, re-encryption is deferred into idle time.
+  /// - @c FunctionPtrs::Encrypt, @c FunctionPtrs::PrefetchPages, @c FunctionPtrs::PinPages,
+  ///   @c FunctionPtrs::QueryPageStats and @c FunctionPtrs::QueryLatencyStats operate on the added pages.
+  /// - @c FunctionPtrs::CreateHeap returns a @c StandInHeap, and @c FunctionPtrs::IsProtected reports
+  ///   @c Options::ReportProtected. All other functions keep their previous behavior.
+  ///
+  /// Pages are encrypted with a simple keystream, which approximates the cost of real encryption but provides
+  /// no protection. The emulator is meant for development and benchmarking only.
+  ///
+  /// @note The emulator installs a @c SIGSEGV handler, which forwards all faults outside of encrypted pages to
+  ///       the previously installed handler.
+  ///
+  /// @note Added ranges must not contain code or data used while handling a fault, i.e. the emulator itself, the
+  ///       C library, or signal handlers. The recommended way is to place the code to encrypt in a dedicated
+  ///       section, and to add the range between the `__start_` and `__stop_` symbols the linker provides for it.
+  class Emulator {
+  public:
+    /// @brief Settings of the emulator.
+    struct Options {
+      /// @brief Interval of periodic re-encryption in milliseconds, or 0 to disable it.
+      uint32_t ReencryptionInterval = 16;
+
+      /// @brief Count of pages re-encrypted per interval.
+      uint32_t ReencryptionCount = 1;
+
+      /// @brief Value returned by @c FunctionPtrs::IsProtected.
+      bool ReportProtected = true;
+
+      /// @brief Whether to defer re-encryption into the idle time reported by @c FunctionPtrs::FrameEnd, like
+      ///        the `frame_scheduling` option of the runtime configuration.
+      bool FrameScheduling = true;
+
+      /// @brief Maximum time in milliseconds re-encryption is deferred while waiting for idle time.
+      uint32_t MaxDeferral = 100;
+
+      /// @brief Time in milliseconds without frame hints after which re-encryption falls back to its timer.
+      uint32_t FallbackTimeout = 250;
+
+      /// @brief Whether to tune the count and interval of re-encryption online, like the `adaptive` option of
+      ///        `periodic_reencryption` in the runtime configuration. The settings above are the starting point.
+      bool Adaptive = false;
+
+      /// @brief Maximum rate of decrypt faults per second targeted by adaptive re-encryption, or 0 for none.
+      uint32_t TargetFaultRate = 100;
+
+      /// @brief Maximum share of a core in percent spent on decrypt faults and re-encryption, or 0 for none.
+      double CpuBudget = 0;
+
+      /// @brief Largest count of pages per interval chosen by adaptive re-encryption.
+      uint32_t MaxCount = 16;
+
+      /// @brief Largest interval in milliseconds chosen by adaptive re-encryption.
+      uint32_t MaxInterval = 1000;
+
+      /// @brief Time in milliseconds over which adaptive re-encryption measures before adjusting.
+      uint32_t AdjustmentPeriod = 1000;
+    };
+
+    /// @brief Replace the interface returned by @c GetInterface with the emulator.
+    ///
+    /// Pages are transformed through `/proc/self/mem`, so installing fails if it cannot be opened for writing.
+    ///
+    /// @param Config Settings of the emulator.
+    /// @return @c true if successful, @c false if the emulator is already installed or installing it failed.
+    static bool Install(const Options& Config) {
+      State& Emulation = GetState();
+      std::lock_guard<std::mutex> Guard(Emulation.Mutex);
+      if (Emulation.Installed.load(std::memory_order_relaxed))
+        return false;
+
+      Emulation.Config = Config;
+      Emulation.PageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      Emulation.Key = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) | 1;
+      Emulation.Start = std::chrono::steady_clock::now();
+      Emulation.IntervalStart = Emulation.Start;
+
+      // writing through /proc/self/mem ignores page protections, so pages never need to be accessible while
+      // they are transformed. Making them writable instead would let other threads access them half-transformed.
+      Emulation.Memory = open("/proc/self/mem", O_RDWR | O_CLOEXEC);
+      if (Emulation.Memory < 0)
+        return false;
+
+      struct sigaction Action {};
+      Action.sa_sigaction = &OnFault;
+      Action.sa_flags = SA_SIGINFO | SA_NODEFER;
+      sigemptyset(&Action.sa_mask);
+      if (sigaction(SIGSEGV, &Action, &Emulation.PreviousHandler) != 0) {
+        close(Emulation.Memory);
+        Emulation.Memory = -1;
+        return false;
+      }
+
+      Emulation.Previous = GetInterface();
+      Emulation.Interface = *Emulation.Previous;
+      Emulation.Interface.IsProtected = &EmulatedIsProtected;
+      Emulation.Interface.Encrypt = &EmulatedEncrypt;
+      Emulation.Interface.QueryPageStats = &EmulatedQueryPageStats;
+      Emulation.Interface.CreateHeap = &EmulatedCreateHeap;
+      Emulation.Interface.EncryptAsync = &EmulatedEncryptAsync;
+      Emulation.Interface.PrefetchPages = &EmulatedPrefetchPages;
+      Emulation.Interface.PinPages = &EmulatedPinPages;
+      Emulation.Interface.UnpinPages = &EmulatedUnpinPages;
+      Emulation.Interface.QueryLatencyStats = &EmulatedQueryLatencyStats;
+      Emulation.Interface.FrameBegin = &EmulatedFrameBegin;
+      Emulation.Interface.FrameEnd = &EmulatedFrameEnd;
+
+      Emulation.Stop = false;
+      Emulation.Cursor = 0;
+      Emulation.PendingPages = 0;
+      Emulation.Count = Config.ReencryptionInterval != 0 ? (std::max)(Config.ReencryptionCount, uint32_t(1)) : 0;
+      Emulation.Interval = Config.ReencryptionInterval;
+      Emulation.Decision = THEIA_REENCRYPTION_FIXED;
+      Emulation.FaultRate = 0;
+      Emulation.OverheadRate = 0;
+      Emulation.InFrame.store(false, std::memory_order_relaxed);
+      Emulation.LastFrameEnd.store(0, std::memory_order_relaxed);
+      Emulation.Worker = std::thread(&RunWorker);
+      Emulation.Installed.store(true, std::memory_order_release);
+
+      // the emulated interface is built from this SDK, so it implements all of its functions
+      Emulation.PreviousVersion = detail::g_TheiaRuntimeVersion;
+      detail::g_TheiaRuntimeVersion = THEIA_INTERFACE_VERSION;
+      detail::g_TheiaVMT = &Emulation.Interface;
+      return true;
+    }
+
+    /// @brief Replace the interface returned by @c GetInterface with the emulator, using default settings.
+    static bool Install() {
+      return Install(Options());
+    }
+
+    /// @brief Decrypt all pages and restore the previous interface.
+    ///
+    /// Pending requests of @c FunctionPtrs::EncryptAsync complete and call their callbacks before this
+    /// returns. Heaps created by the emulator remain valid.
+    static void Uninstall() {
+      State& Emulation = GetState();
+      {
+        std::lock_guard<std::mutex> Guard(Emulation.Mutex);
+        if (!Emulation.Installed.load(std::memory_order_relaxed))
+          return;
+        Emulation.Stop = true;
+      }
+      Emulation.Wake.notify_all();
+      Emulation.Worker.join();
+
+      std::lock_guard<std::mutex> Guard(Emulation.Mutex);
+      detail::g_TheiaVMT = Emulation.Previous;
+      detail::g_TheiaRuntimeVersion = Emulation.PreviousVersion;
+
+      const size_t RangeCount = Emulation.RangeCount.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < RangeCount; ++i) {
+        Range& Target = Emulation.Ranges[i];
+        for (size_t Index = 0; Index < Target.PageCount; ++Index)
+          DecryptPage(Target.Pages[Index], Target.Begin + Index * Emulation.PageSize);
+      }
+      // fault handlers that read the range count before it was reset may still be reading the ranges
+      Emulation.RangeCount.store(0, std::memory_order_seq_cst);
+      while (Emulation.Handlers.load(std::memory_order_seq_cst) != 0)
+        std::this_thread::yield();
+      for (size_t i = 0; i < RangeCount; ++i) {
+        delete[] Emulation.Ranges[i].Pages;
+        Emulation.Ranges[i] = Range{};
+      }
+
+      // only restore the previous handler if no other handler was installed on top of ours since
+      struct sigaction Current {};
+      if (sigaction(SIGSEGV, nullptr, &Current) == 0 && (Current.sa_flags & SA_SIGINFO) != 0 && Current.sa_sigaction == &OnFault)
+        sigaction(SIGSEGV, &Emulation.PreviousHandler, nullptr);
+      close(Emulation.Memory);
+      Emulation.Memory = -1;
+      Emulation.Installed.store(false, std::memory_order_release);
+    }
+
+    /// @brief Encrypt all pages entirely within [`Begin`, `End`), until they are accessed.
+    ///
+    /// Pages only partially within the range are not encrypted, so that the range may be unaligned. The pages
+    /// keep their protection when they are decrypted.
+    ///
+    /// @param Begin Start of the range to encrypt.
+    /// @param End End of the range to encrypt, exclusive.
+    /// @return Count of pages encrypted, or 0 if the emulator is not installed, or the range is unmapped or
+    ///         overlaps a range added before.
+    static size_t AddRange(const void* Begin, const void* End) {
+      State& Emulation = GetState();
+      std::lock_guard<std::mutex> Guard(Emulation.Mutex);
+      const size_t RangeCount = Emulation.RangeCount.load(std::memory_order_relaxed);
+      if (!Emulation.Installed.load(std::memory_order_relaxed) || RangeCount == MaxRanges)
+        return 0;
+
+      const uintptr_t First = RoundUp(reinterpret_cast<uintptr_t>(Begin), Emulation.PageSize);
+      const uintptr_t Last = reinterpret_cast<uintptr_t>(End) & ~(Emulation.PageSize - 1);
+      if (First >= Last)
+        return 0;
+      for (size_t i = 0; i < RangeCount; ++i) {
+        if (First < Emulation.Ranges[i].End && Emulation.Ranges[i].Begin < Last)
+          return 0;
+      }
+
+      const size_t PageCount = (Last - First) / Emulation.PageSize;
+      Page* Pages = new (std::nothrow) Page[PageCount];
+      if (Pages == nullptr)
+        return 0;
+
+      const std::string Maps = ReadMaps();
+      for (size_t Index = 0; Index < PageCount; ++Index) {
+        const uintptr_t Address = First + Index * Emulation.PageSize;
+        if (!FindProtection(Maps, Address, Pages[Index].Protection)) {
+          delete[] Pages;
+          return 0;
+        }
+        Pages[Index].Rva = RvaOf(Address);
+      }
+
+      // register the range before encrypting it, so that faults on its pages are handled right away
+      Range& Target = Emulation.Ranges[RangeCount];
+      Target.Begin = First;
+      Target.End = Last;
+      Target.PageCount = PageCount;
+      Target.Pages = Pages;
+      Emulation.RangeCount.store(RangeCount + 1, std::memory_order_release);
+
+      for (size_t Index = 0; Index < PageCount; ++Index)
+        EncryptPage(Pages[Index], First + Index * Emulation.PageSize);
+      return PageCount;
+    }
+
+    /// @brief Whether the emulator is installed.
+    static bool IsInstalled() {
+      return GetState().Installed.load(std::memory_order_acquire);
+    }
+
+  private:
+    enum : size_t {
+      MaxRanges = 64,
+      ChunkSize = 0x1000,
+    };
+
+    // State of a single encrypted page. The lock is a spin lock, as it is taken by the fault handler.
+    struct Page {
+      std::atomic<bool> Lock{false};
+      std::atomic<bool> Encrypted{false};
+      int Protection = 0;
+      uint32_t Rva = 0;
+      std::atomic<uint32_t> PinCount{0};
+      std::atomic<uint32_t> DecryptCount{0};
+      std::atomic<uint32_t> ReencryptCount{0};
+      std::atomic<uint64_t> LastDecryptMilliseconds{0};
+    };
+
+    struct Range {
+      uintptr_t Begin;
+      uintptr_t End;
+      size_t PageCount;
+      Page* Pages;
+    };
+
+    // LatencyHistogram that can be updated from the fault handler.
+    struct Histogram {
+      std::atomic<uint64_t> Count{0};
+      std::atomic<uint64_t> TotalNanoseconds{0};
+      std::atomic<uint64_t> MaxNanoseconds{0};
+      std::atomic<uint64_t> Buckets[THEIA_LATENCY_BUCKETS]{};
+
+      void Record(uint64_t Nanoseconds) {
+        const size_t Bucket = Nanoseconds != 0 ? static_cast<size_t>(63 - __builtin_clzll(Nanoseconds)) : 0;
+        Buckets[(std::min)(Bucket, static_cast<size_t>(THEIA_LATENCY_BUCKETS - 1))].fetch_add(1, std::memory_order_relaxed);
+        Count.fetch_add(1, std::memory_order_relaxed);
+        TotalNanoseconds.fetch_add(Nanoseconds, std::memory_order_relaxed);
+        uint64_t Max = MaxNanoseconds.load(std::memory_order_relaxed);
+        while (Nanoseconds > Max && !MaxNanoseconds.compare_exchange_weak(Max, Nanoseconds, std::memory_order_relaxed)) {
+        }
+      }
+
+      void Read(LatencyHistogram& Output, bool Reset) {
+        Output.Count = Reset ? Count.exchange(0, std::memory_order_relaxed) : Count.load(std::memory_order_relaxed);
+        Output.TotalNanoseconds = Reset ? TotalNanoseconds.exchange(0, std::memory_order_relaxed) : TotalNanoseconds.load(std::memory_order_relaxed);
+        Output.MaxNanoseconds = Reset ? MaxNanoseconds.exchange(0, std::memory_order_relaxed) : MaxNanoseconds.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < THEIA_LATENCY_BUCKETS; ++i)
+          Output.Buckets[i] = Reset ? Buckets[i].exchange(0, std::memory_order_relaxed) : Buckets[i].load(std::memory_order_relaxed);
+      }
+    };
+
+    struct AsyncRequest {
+      uint32_t Amount;
+      EncryptCallbackType* Callback;
+      void* Context;
+    };
+
+    struct State {
+      std::atomic<bool> Installed{false};
+      Options Config;
+      FunctionPtrs Interface{};
+      const FunctionPtrs* Previous = nullptr;
+      uint32_t PreviousVersion = 0;
+      struct sigaction PreviousHandler {};
+      int Memory = -1;
+      size_t PageSize = 0;
+      uint64_t Key = 0;
+      std::chrono::steady_clock::time_point Start;
+
+      // ranges are only appended while the emulator is installed, so the fault handler can read them unlocked.
+      // Uninstall waits for the handlers counted in `Handlers` before releasing them.
+      Range Ranges[MaxRanges]{};
+      std::atomic<size_t> RangeCount{0};
+      std::atomic<uint32_t> Handlers{0};
+
+      // serializes everything except fault handling
+      std::mutex Mutex;
+      size_t Cursor = 0;
+      std::thread Worker;
+      std::condition_variable Wake;
+      bool Stop = false;
+      std::deque<AsyncRequest> Requests;
+
+      Histogram DecryptFaults;
+      Histogram PeriodicTasks;
+
+      // settings of periodic re-encryption, tuned by adaptive re-encryption, and its measurements since the
+      // start of the current adjustment period
+      uint32_t Count = 0;
+      uint32_t Interval = 0;
+      uint32_t Decision = THEIA_REENCRYPTION_FIXED;
+      uint32_t FaultRate = 0;
+      uint32_t OverheadRate = 0;
+      std::atomic<uint64_t> PeriodFaults{0};
+      std::atomic<uint64_t> PeriodNanoseconds{0};
+
+      // re-encryption of ticks that were deferred waiting for idle time, or cut short by its end
+      uint32_t PendingPages = 0;
+      std::chrono::steady_clock::time_point PendingSince;
+
+      // frame hints, in nanoseconds of the steady clock, which are updated without taking the mutex
+      std::atomic<bool> InFrame{false};
+      std::atomic<int64_t> LastFrameEnd{0};
+      std::atomic<int64_t> IdleDeadline{0};
+      std::chrono::steady_clock::time_point IntervalStart;
+    };
+
+    static State& GetState() {
+      static State s_State;
+      return s_State;
+    }
+
+    static constexpr uintptr_t RoundUp(uintptr_t Value, size_t Alignment) {
+      return (Value + Alignment - 1) & ~static_cast<uintptr_t>(Alignment - 1);
+    }
+
+    static uint64_t ElapsedSince(std::chrono::steady_clock::time_point Start) {
+      return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count());
+    }
+
+    static std::string ReadMaps() {
+      std::string Result;
+      const int File = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+      if (File < 0)
+        return Result;
+      char Buffer[4096];
+      ssize_t Read;
+      while ((Read = read(File, Buffer, sizeof(Buffer))) > 0)
+        Result.append(Buffer, static_cast<size_t>(Read));
+      close(File);
+      return Result;
+    }
+
+    // Look up the protection of the mapping containing `Address` in the contents of /proc/self/maps.
+    static bool FindProtection(const std::string& Maps, uintptr_t Address, int& Protection) {
+      for (size_t Line = 0; Line < Maps.size();) {
+        const size_t Next = Maps.find('\n', Line);
+        const char* Text = Maps.c_str() + Line;
+        char* Cursor = nullptr;
+        const uintptr_t MappingBegin = std::strtoull(Text, &Cursor, 16);
+        const uintptr_t MappingEnd = std::strtoull(Cursor + 1, &Cursor, 16);
+        if (Address >= MappingBegin && Address < MappingEnd) {
+          Protection = (Cursor[1] == 'r' ? PROT_READ : 0) | (Cursor[2] == 'w' ? PROT_WRITE : 0) | (Cursor[3] == 'x' ? PROT_EXEC : 0);
+          return true;
+        }
+        Line = Next == std::string::npos ? Maps.size() : Next + 1;
+      }
+      return false;
+    }
+
+    // RVA of `Address` within the module containing it, or the low 32 bits of the address outside of modules.
+    static uint32_t RvaOf(uintptr_t Address) {
+      struct Search {
+        uintptr_t Address;
+        uintptr_t Base;
+      } Module{Address, 0};
+
+      dl_iterate_phdr(
+        [](dl_phdr_info* Info, size_t, void* Context) {
+          Search* Target = static_cast<Search*>(Context);
+          uintptr_t Lowest = UINTPTR_MAX;
+          bool Contains = false;
+          for (ElfW(Half) i = 0; i < Info->dlpi_phnum; ++i) {
+            const ElfW(Phdr)& Header = Info->dlpi_phdr[i];
+            if (Header.p_type != PT_LOAD)
+              continue;
+            const uintptr_t Begin = Info->dlpi_addr + Header.p_vaddr;
+            Lowest = (std::min)(Lowest, Begin);
+            Contains = Contains || (Target->Address >= Begin && Target->Address < Begin + Header.p_memsz);
+          }
+          if (!Contains)
+            return 0;
+          Target->Base = Lowest & ~static_cast<uintptr_t>(0xfff);
+          return 1;
+        },
+        &Module);
+      return static_cast<uint32_t>(Address - Module.Base);
+    }
+
+    // Requires the caller to be counted in `Handlers`, which it must increment before calling this.
+    static Page* FindPage(uintptr_t Address, uintptr_t& PageAddress) {
+      State& Emulation = GetState();
+      const size_t RangeCount = Emulation.RangeCount.load(std::memory_order_seq_cst);
+      for (size_t i = 0; i < RangeCount; ++i) {
+        const Range& Target = Emulation.Ranges[i];
+        if (Address >= Target.Begin && Address < Target.End) {
+          const size_t Index = (Address - Target.Begin) / Emulation.PageSize;
+          PageAddress = Target.Begin + Index * Emulation.PageSize;
+          return &Target.Pages[Index];
+        }
+      }
+      return nullptr;
+    }
+
+    // Page by its index across all ranges, in the order the ranges were added.
+    static Page* PageAt(size_t Index, uintptr_t& PageAddress) {
+      State& Emulation = GetState();
+      const size_t RangeCount = Emulation.RangeCount.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < RangeCount; ++i) {
+        const Range& Target = Emulation.Ranges[i];
+        if (Index < Target.PageCount) {
+          PageAddress = Target.Begin + Index * Emulation.PageSize;
+          return &Target.Pages[Index];
+        }
+        Index -= Target.PageCount;
+      }
+      return nullptr;
+    }
+
+    static size_t TotalPageCount() {
+      State& Emulation = GetState();
+      size_t Result = 0;
+      const size_t RangeCount = Emulation.RangeCount.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < RangeCount; ++i)
+        Result += Emulation.Ranges[i].PageCount;
+      return Result;
+    }
+
+    static void LockPage(Page& Target) {
+      while (Target.Lock.exchange(true, std::memory_order_acquire)) {
+      }
+    }
+
+    static void UnlockPage(Page& Target) {
+      Target.Lock.store(false, std::memory_order_release);
+    }
+
+    // XOR the bytes with a keystream derived from their address, which is its own inverse.
+    static void Transform(uint8_t* Bytes, size_t Size, uintptr_t Address) {
+      const uint64_t Key = GetState().Key;
+      for (size_t Offset = 0; Offset < Size; Offset += sizeof(uint64_t)) {
+        uint64_t Stream = (Key ^ (Address + Offset)) + 0x9e3779b97f4a7c15ull;
+        Stream = (Stream ^ (Stream >> 30)) * 0xbf58476d1ce4e5b9ull;
+        Stream = (Stream ^ (Stream >> 27)) * 0x94d049bb133111ebull;
+        Stream ^= Stream >> 31;
+
+        uint64_t Word;
+        std::memcpy(&Word, Bytes + Offset, sizeof(Word));
+        Word ^= Stream;
+        std::memcpy(Bytes + Offset, &Word, sizeof(Word));
+      }
+    }
+
+    // Transform an inaccessible page through /proc/self/mem and give it `Protection`. This is called from the
+    // fault handler, so it may neither allocate nor lock.
+    static void TransformPage(uintptr_t PageAddress, int Protection) {
+      State& Emulation = GetState();
+      uint8_t Chunk[ChunkSize];
+      for (size_t Offset = 0; Offset < Emulation.PageSize; Offset += ChunkSize) {
+        const off_t Position = static_cast<off_t>(PageAddress + Offset);
+        if (pread(Emulation.Memory, Chunk, ChunkSize, Position) != static_cast<ssize_t>(ChunkSize))
+          break;
+        Transform(Chunk, ChunkSize, PageAddress + Offset);
+        if (pwrite(Emulation.Memory, Chunk, ChunkSize, Position) != static_cast<ssize_t>(ChunkSize))
+          break;
+      }
+
+      mprotect(reinterpret_cast<void*>(PageAddress), Emulation.PageSize, Protection);
+      if ((Protection & PROT_EXEC) != 0)
+        __builtin___clear_cache(reinterpret_cast<char*>(PageAddress), reinterpret_cast<char*>(PageAddress + Emulation.PageSize));
+    }
+
+    static bool EncryptPage(Page& Target, uintptr_t PageAddress) {
+      LockPage(Target);
+      const bool Encrypt = !Target.Encrypted.load(std::memory_order_relaxed);
+      if (Encrypt) {
+        // other threads touching the page from now on fault, and wait for the page lock
+        mprotect(reinterpret_cast<void*>(PageAddress), GetState().PageSize, PROT_NONE);
+        TransformPage(PageAddress, PROT_NONE);
+        Target.Encrypted.store(true, std::memory_order_relaxed);
+        Target.ReencryptCount.fetch_add(1, std::memory_order_relaxed);
+      }
+      UnlockPage(Target);
+      return Encrypt;
+    }
+
+    static bool DecryptPage(Page& Target, uintptr_t PageAddress) {
+      LockPage(Target);
+      const bool Decrypt = Target.Encrypted.load(std::memory_order_relaxed);
+      if (Decrypt) {
+        TransformPage(PageAddress, Target.Protection);
+        Target.Encrypted.store(false, std::memory_order_relaxed);
+        const uint64_t Milliseconds = ElapsedSince(GetState().Start) / 1000000;
+        Target.LastDecryptMilliseconds.store((std::max)(Milliseconds, uint64_t(1)), std::memory_order_relaxed);
+      }
+      UnlockPage(Target);
+      return Decrypt;
+    }
+
+    // Decrypt encrypted pages when they are touched. All other faults are forwarded to the previous handler.
+    static void OnFault(int Signal, siginfo_t* Info, void* Context) {
+      State& Emulation = GetState();
+      const auto Start = std::chrono::steady_clock::now();
+      const uintptr_t Address = reinterpret_cast<uintptr_t>(Info->si_addr);
+
+      // a fault on a page that is not encrypted was either resolved by another thread in the meantime, or is
+      // a genuine fault, which faults again at the same address
+      static thread_local uintptr_t s_LastUnresolved = 0;
+
+      // counted until the ranges are no longer read, but not while the previous handler runs, which may never
+      // return
+      Emulation.Handlers.fetch_add(1, std::memory_order_seq_cst);
+      bool Handled = false;
+      uintptr_t PageAddress = 0;
+      Page* Target = FindPage(Address, PageAddress);
+      if (Target != nullptr) {
+        if (DecryptPage(*Target, PageAddress)) {
+          Target->DecryptCount.fetch_add(1, std::memory_order_relaxed);
+          const uint64_t Elapsed = ElapsedSince(Start);
+          Emulation.DecryptFaults.Record(Elapsed);
+          Emulation.PeriodFaults.fetch_add(1, std::memory_order_relaxed);
+          Emulation.PeriodNanoseconds.fetch_add(Elapsed, std::memory_order_relaxed);
+          s_LastUnresolved = 0;
+          Handled = true;
+        } else if (s_LastUnresolved != Address) {
+          s_LastUnresolved = Address;
+          Handled = true;
+        } else {
+          s_LastUnresolved = 0;
+        }
+      }
+      Emulation.Handlers.fetch_sub(1, std::memory_order_release);
+      if (Handled)
+        return;
+
+      const struct sigaction& Previous = Emulation.PreviousHandler;
+      if ((Previous.sa_flags & SA_SIGINFO) != 0 && Previous.sa_sigaction != nullptr) {
+        Previous.sa_sigaction(Signal, Info, Context);
+      } else if (Previous.sa_handler != SIG_DFL && Previous.sa_handler != SIG_IGN) {
+        Previous.sa_handler(Signal);
+      } else {
+        // returning re-executes the faulting instruction, which now crashes with the default action
+        signal(SIGSEGV, SIG_DFL);
+      }
+    }
+
+    // Re-encrypt pages as requested by Encrypt, resuming budgeted requests at the cursor. Requires the mutex.
+    static void EncryptAmount(uint32_t Amount) {
+      State& Emulation = GetState();
+      const size_t Total = TotalPageCount();
+      uintptr_t PageAddress = 0;
+
+      if (Amount == THEIA_ENCRYPT_ALL) {
+        for (size_t Index = 0; Index < Total; ++Index) {
+          Page* Target = PageAt(Index, PageAddress);
+          EncryptPage(*Target, PageAddress);
+        }
+        return;
+      }
+
+      const bool Timed = (Amount & THEIA_ENCRYPT_MICROSECONDS) != 0;
+      const uint32_t Budget = Amount & ~static_cast<uint32_t>(THEIA_ENCRYPT_MICROSECONDS);
+      const auto Start = std::chrono::steady_clock::now();
+      uint32_t Encrypted = 0;
+      for (size_t Visited = 0; Visited < Total && Budget != 0; ++Visited) {
+        Page* Target = PageAt(Emulation.Cursor, PageAddress);
+        Emulation.Cursor = (Emulation.Cursor + 1) % Total;
+        if (Target->PinCount.load(std::memory_order_relaxed) == 0 && EncryptPage(*Target, PageAddress))
+          ++Encrypted;
+        if (Timed ? ElapsedSince(Start) >= uint64_t(Budget) * 1000 : Encrypted >= Budget)
+          break;
+      }
+    }
+
+    // Re-encrypt pending pages, preferring decrypted, unpinned pages that were decrypted the longest time ago,
+    // until `Deadline`. Requires the mutex.
+    static void ReencryptPeriodically(std::chrono::steady_clock::time_point Deadline) {
+      State& Emulation = GetState();
+      const auto Start = std::chrono::steady_clock::now();
+      const size_t Total = TotalPageCount();
+      uintptr_t PageAddress = 0;
+
+      while (Emulation.PendingPages != 0 && std::chrono::steady_clock::now() < Deadline) {
+        Page* Oldest = nullptr;
+        uintptr_t OldestAddress = 0;
+        for (size_t Index = 0; Index < Total; ++Index) {
+          Page* Target = PageAt(Index, PageAddress);
+          if (Target->Encrypted.load(std::memory_order_relaxed) || Target->PinCount.load(std::memory_order_relaxed) != 0)
+            continue;
+          if (Oldest == nullptr || Target->LastDecryptMilliseconds.load(std::memory_order_relaxed) < Oldest->LastDecryptMilliseconds.load(std::memory_order_relaxed)) {
+            Oldest = Target;
+            OldestAddress = PageAddress;
+          }
+        }
+        if (Oldest == nullptr) {
+          Emulation.PendingPages = 0;
+          break;
+        }
+        EncryptPage(*Oldest, OldestAddress);
+        --Emulation.PendingPages;
+      }
+      const uint64_t Elapsed = ElapsedSince(Start);
+      Emulation.PeriodicTasks.Record(Elapsed);
+      Emulation.PeriodNanoseconds.fetch_add(Elapsed, std::memory_order_relaxed);
+    }
+
+    static std::chrono::steady_clock::time_point FromNanoseconds(int64_t Nanoseconds) {
+      return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(Nanoseconds)));
+    }
+
+    static int64_t ToNanoseconds(std::chrono::steady_clock::time_point Time) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(Time.time_since_epoch()).count();
+    }
+
+    // Decide whether pending re-encryption may run at `Now`, and until which `Deadline`. If it must be
+    // deferred, `Deadline` is the time to decide again instead. Requires the mutex.
+    static bool MayRunPeriodically(std::chrono::steady_clock::time_point Now, std::chrono::steady_clock::time_point& Deadline) {
+      State& Emulation = GetState();
+      const Options& Config = Emulation.Config;
+      const auto LastFrameEnd = FromNanoseconds(Emulation.LastFrameEnd.load(std::memory_order_acquire));
+      const auto FallbackAt = LastFrameEnd + std::chrono::milliseconds(Config.FallbackTimeout);
+      const auto ForcedAt = Emulation.PendingSince + std::chrono::milliseconds(Config.MaxDeferral);
+
+      Deadline = std::chrono::steady_clock::time_point::max();
+      if (!Config.FrameScheduling || Emulation.LastFrameEnd.load(std::memory_order_relaxed) == 0 || Now >= FallbackAt || Now >= ForcedAt)
+        return true;
+
+      const auto IdleDeadline = FromNanoseconds(Emulation.IdleDeadline.load(std::memory_order_relaxed));
+      if (!Emulation.InFrame.load(std::memory_order_acquire) && Now < IdleDeadline) {
+        Deadline = IdleDeadline;
+        return true;
+      }
+
+      // wait for the next call to FrameEnd, which wakes the worker, but not beyond the deferral limits
+      Deadline = (std::min)(FallbackAt, ForcedAt);
+      return false;
+    }
+
+    // Compare the fault rate and overhead of the past adjustment period with the targets, and re-encrypt fewer
+    // pages if either was exceeded, or more if both were below half of them. Requires the mutex.
+    static void AdjustPeriodically(uint64_t PeriodNanoseconds) {
+      State& Emulation = GetState();
+      const Options& Config = Emulation.Config;
+      const double Seconds = (std::max)(static_cast<double>(PeriodNanoseconds) / 1e9, 1e-3);
+      const double FaultRate = static_cast<double>(Emulation.PeriodFaults.exchange(0, std::memory_order_relaxed)) / Seconds;
+      const double OverheadRate = static_cast<double>(Emulation.PeriodNanoseconds.exchange(0, std::memory_order_relaxed)) / 1000 / Seconds;
+      Emulation.FaultRate = static_cast<uint32_t>(FaultRate);
+      Emulation.OverheadRate = static_cast<uint32_t>(OverheadRate);
+
+      // a budget of 1% of a core is 10ms per second
+      const double OverheadBudget = Config.CpuBudget * 10000;
+      const bool Exceeded = (Config.TargetFaultRate != 0 && FaultRate > Config.TargetFaultRate) || (Config.CpuBudget > 0 && OverheadRate > OverheadBudget);
+      const bool Below = (Config.TargetFaultRate == 0 || FaultRate * 2 <= Config.TargetFaultRate) && (Config.CpuBudget <= 0 || OverheadRate * 2 <= OverheadBudget);
+      const uint32_t MinInterval = (std::min)(Config.ReencryptionInterval, uint32_t(16));
+
+      Emulation.Decision = THEIA_REENCRYPTION_HELD;
+      if (Exceeded) {
+        if (Emulation.Count > 1)
+          Emulation.Count /= 2;
+        else if (Emulation.Interval < Config.MaxInterval)
+          Emulation.Interval = (std::min)(Emulation.Interval * 2, Config.MaxInterval);
+        else
+          return;
+        Emulation.Decision = THEIA_REENCRYPTION_DECREASED;
+      } else if (Below) {
+        if (Emulation.Interval > MinInterval)
+          Emulation.Interval = (std::max)(Emulation.Interval / 2, MinInterval);
+        else if (Emulation.Count < Config.MaxCount)
+          ++Emulation.Count;
+        else
+          return;
+        Emulation.Decision = THEIA_REENCRYPTION_INCREASED;
+      }
+    }
+
+    static void RunWorker() {
+      State& Emulation = GetState();
+      std::unique_lock<std::mutex> Lock(Emulation.Mutex);
+      const bool Adaptive = Emulation.Config.Adaptive && Emulation.Interval != 0;
+      const auto AdjustmentPeriod = std::chrono::milliseconds(Emulation.Config.AdjustmentPeriod);
+      auto LastAdjustment = std::chrono::steady_clock::now();
+      auto NextTick = LastAdjustment + std::chrono::milliseconds(Emulation.Interval);
+
+      for (;;) {
+        // once stopped, no further requests are accepted, but the queued ones still complete before the worker
+        // exits, so that the callback of every accepted request is called
+        while (!Emulation.Requests.empty()) {
+          const AsyncRequest Request = Emulation.Requests.front();
+          Emulation.Requests.pop_front();
+          EncryptAmount(Request.Amount);
+
+          // the callback may make further requests, which take the mutex
+          if (Request.Callback != nullptr) {
+            Lock.unlock();
+            Request.Callback(Request.Context);
+            Lock.lock();
+          }
+        }
+        if (Emulation.Stop)
+          break;
+
+        const auto Now = std::chrono::steady_clock::now();
+        if (Adaptive && Now >= LastAdjustment + AdjustmentPeriod) {
+          AdjustPeriodically(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Now - LastAdjustment).count()));
+          LastAdjustment = Now;
+        }
+        if (Emulation.Interval != 0 && Now >= NextTick) {
+          if (Emulation.PendingPages == 0)
+            Emulation.PendingSince = Now;
+          Emulation.PendingPages += Emulation.Count;
+          NextTick = (std::max)(NextTick + std::chrono::milliseconds(Emulation.Interval), Now);
+        }
+
+        auto WakeAt = Adaptive ? (std::min)(NextTick, LastAdjustment + AdjustmentPeriod) : NextTick;
+        if (Emulation.PendingPages != 0) {
+          std::chrono::steady_clock::time_point Deadline;
+          if (MayRunPeriodically(Now, Deadline))
+            ReencryptPeriodically(Deadline);
+          else
+            WakeAt = (std::min)(WakeAt, Deadline);
+        }
+
+        // requests made while the mutex was released are processed right away, otherwise they wake the worker
+        if (!Emulation.Requests.empty())
+          continue;
+        if (Emulation.Interval != 0 || Emulation.PendingPages != 0)
+          Emulation.Wake.wait_until(Lock, WakeAt);
+        else
+          Emulation.Wake.wait(Lock);
+      }
+    }
+
+    static void EmulatedFrameBegin() {
+      GetState().InFrame.store(true, std::memory_order_release);
+    }
+
+    static void EmulatedFrameEnd(uint32_t IdleBudgetMicroseconds) {
+      State& Emulation = GetState();
+      const auto Now = std::chrono::steady_clock::now();
+      Emulation.IdleDeadline.store(ToNanoseconds(Now + std::chrono::microseconds(IdleBudgetMicroseconds)), std::memory_order_relaxed);
+      Emulation.LastFrameEnd.store((std::max)(ToNanoseconds(Now), int64_t(1)), std::memory_order_relaxed);
+      Emulation.InFrame.store(false, std::memory_order_release);
+
+      // taking the mutex orders the update before the worker's decision to wait, so the wakeup is not lost
+      { std::lock_guard<std::mutex> Guard(Emulation.Mutex); }
+      Emulation.Wake.notify_all();
+    }
+
+    static bool EmulatedIsProtected() {
+      return GetState().Config.ReportProtected;
+    }
+
+    static void EmulatedEncrypt(uint32_t Amount) {
+      std::lock_guard<std::mutex> Guard(GetState().Mutex);
+      EncryptAmount(Amount);
+    }
+
+    static bool EmulatedEncryptAsync(uint32_t Amount, EncryptCallbackType* Callback, void* Context) {
+      State& Emulation = GetState();
+      {
+        std::lock_guard<std::mutex> Guard(Emulation.Mutex);
+        if (Emulation.Stop)
+          return false;
+        Emulation.Requests.push_back(AsyncRequest{Amount, Callback, Context});
+      }
+      Emulation.Wake.notify_all();
+      return true;
+    }
+
+    // Call `Visit` with every page overlapping [Begin, End). Requires the mutex.
+    template <typename F>
+    static void VisitPages(const void* Begin, const void* End, F&& Visit) {
+      State& Emulation = GetState();
+      const uintptr_t First = reinterpret_cast<uintptr_t>(Begin);
+      const uintptr_t Last = reinterpret_cast<uintptr_t>(End);
+      const size_t RangeCount = Emulation.RangeCount.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < RangeCount; ++i) {
+        const Range& Target = Emulation.Ranges[i];
+        if (Last <= Target.Begin || First >= Target.End)
+          continue;
+        const size_t FirstIndex = First > Target.Begin ? (First - Target.Begin) / Emulation.PageSize : 0;
+        const size_t LastIndex = Last < Target.End ? (Last - Target.Begin + Emulation.PageSize - 1) / Emulation.PageSize : Target.PageCount;
+        for (size_t Index = FirstIndex; Index < LastIndex; ++Index)
+          Visit(Target.Pages[Index], Target.Begin + Index * Emulation.PageSize);
+      }
+    }
+
+    static size_t EmulatedPrefetchPages(const void* Begin, const void* End) {
+      std::lock_guard<std::mutex> Guard(GetState().Mutex);
+      size_t Result = 0;
+      VisitPages(Begin, End, [&](Page& Target, uintptr_t PageAddress) {
+        Result += DecryptPage(Target, PageAddress) ? 1 : 0;
+      });
+      return Result;
+    }
+
+    static size_t EmulatedPinPages(const void* Begin, const void* End) {
+      std::lock_guard<std::mutex> Guard(GetState().Mutex);
+      size_t Result = 0;
+      VisitPages(Begin, End, [&](Page& Target, uintptr_t) {
+        Target.PinCount.fetch_add(1, std::memory_order_relaxed);
+        ++Result;
+      });
+      return Result;
+    }
+
+    static size_t EmulatedUnpinPages(const void* Begin, const void* End) {
+      std::lock_guard<std::mutex> Guard(GetState().Mutex);
+      size_t Result = 0;
+      VisitPages(Begin, End, [&](Page& Target, uintptr_t) {
+        if (Target.PinCount.load(std::memory_order_relaxed) != 0)
+          Target.PinCount.fetch_sub(1, std::memory_order_relaxed);
+        ++Result;
+      });
+      return Result;
+    }
+
+    static size_t EmulatedQueryPageStats(PageStats* OutputBuffer) {
+      // validates the size of the structure, and clears the fields it covers
+      if (detail::DefaultQueryPageStats(OutputBuffer) != 0)
+        return (size_t)-1;
+
+      std::lock_guard<std::mutex> Guard(GetState().Mutex);
+      const uint32_t BufferSize = OutputBuffer->BufferSize;
+      const size_t Total = TotalPageCount();
+      uint32_t Decrypted = 0;
+      uint32_t Pinned = 0;
+      uintptr_t PageAddress = 0;
+      for (size_t Index = 0; Index < Total; ++Index) {
+        Page* Target = PageAt(Index, PageAddress);
+        const bool IsDecrypted = !Target->Encrypted.load(std::memory_order_relaxed);
+        const bool IsPinned = Target->PinCount.load(std::memory_order_relaxed) != 0;
+        Decrypted += IsDecrypted ? 1 : 0;
+        Pinned += IsPinned ? 1 : 0;
+
+        if (BufferSize > offsetof(PageStats, Pages) && OutputBuffer->Pages != nullptr && Index < OutputBuffer->PagesCapacity) {
+          PageStatsEntry& Entry = OutputBuffer->Pages[Index];
+          Entry.Rva = Target->Rva;
+          Entry.Flags = (IsDecrypted ? uint32_t(THEIA_PAGE_DECRYPTED) : 0u) | (IsPinned ? uint32_t(THEIA_PAGE_PINNED) : 0u);
+          Entry.DecryptCount = Target->DecryptCount.load(std::memory_order_relaxed);
+          Entry.ReencryptCount = Target->ReencryptCount.load(std::memory_order_relaxed);
+          Entry.LastDecryptMilliseconds = Target->LastDecryptMilliseconds.load(std::memory_order_relaxed);
+        }
+      }
+
+      OutputBuffer->CountPagesTotal = static_cast<uint32_t>(Total);
+      OutputBuffer->CountPagesDecrypted = Decrypted;
+      OutputBuffer->CountPagesEncryptableTotal = static_cast<uint32_t>(Total);
+      OutputBuffer->CountPagesEncryptableDecrypted = Decrypted;
+      if (BufferSize > offsetof(PageStats, CountPagesPinned))
+        OutputBuffer->CountPagesPinned = Pinned;
+      if (BufferSize > offsetof(PageStats, Pages))
+        OutputBuffer->PagesCount = static_cast<uint32_t>(Total);
+      if (BufferSize > offsetof(PageStats, ReencryptionCount)) {
+        State& Emulation = GetState();
+        OutputBuffer->ReencryptionCount = Emulation.Count;
+        OutputBuffer->ReencryptionInterval = Emulation.Interval;
+        OutputBuffer->ReencryptionDecision = Emulation.Decision;
+        OutputBuffer->DecryptFaultRate = Emulation.FaultRate;
+        OutputBuffer->OverheadMicrosecondsPerSecond = Emulation.OverheadRate;
+      }
+      return 0;
+    }
+
+    static Heap* EmulatedCreateHeap(size_t ReservedSize, size_t MaxAllocSize, void* /* Reserved */) {
+      return StandInHeap::Create(ReservedSize, MaxAllocSize);
+    }
+
+    static size_t EmulatedQueryLatencyStats(LatencyStats* OutputBuffer, bool Reset) {
+      if (OutputBuffer->BufferSize != sizeof(LatencyStats))
+        return (size_t)-1;
+
+      State& Emulation = GetState();
+      std::lock_guard<std::mutex> Guard(Emulation.Mutex);
+      *OutputBuffer = {};
+      OutputBuffer->IntervalNanoseconds = ElapsedSince(Emulation.IntervalStart);
+      Emulation.DecryptFaults.Read(OutputBuffer->DecryptFaults, Reset);
+      Emulation.PeriodicTasks.Read(OutputBuffer->PeriodicTasks, Reset);
+      if (Reset)
+        Emulation.IntervalStart = std::chrono::steady_clock::now();
+      return 0;
+    }
+  };
+} // namespace THEIA_REAL_NAMESPACE
@@ -0,0 +1,2103 @@
+/// @file theia_heap.hpp
+/// @copyright Copyright (C) Zero IT Lab - All Rights Reserved
+/// @brief Optional allocator adapters and helpers for Theia protected heaps.
+///
+/// Unauthorized copying of this file, via any medium is strictly prohibited
+/// Proprietary and confidential
+#pragma once
+
+#include "theia_sdk.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(_MSVC_LANG)
+#define THEIA_CPLUSPLUS _MSVC_LANG
+#else
+#define THEIA_CPLUSPLUS __cplusplus
+#endif
+
+#if THEIA_CPLUSPLUS >= 201703L && defined __has_include
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define THEIA_HAS_MEMORY_RESOURCE 1
+#endif
+#endif
+
+#if defined(__cpp_exceptions) || defined(_CPPUNWIND)
+#define THEIA_HAS_EXCEPTIONS 1
+#define THEIA_THROW_BAD_ALLOC() throw std::bad_alloc()
+#else
+#define THEIA_THROW_BAD_ALLOC() std::abort()
+#endif
+
+// Internal helpers for the allocator adapters, feel free to ignore.
+namespace THEIA_REAL_NAMESPACE {
+  namespace detail {
+    /// @brief Alignment guaranteed by every Heap::Allocate implementation.
+    constexpr size_t HeapBaseAlignment = 16;
+
+    constexpr bool IsPowerOfTwo(size_t Value) {
+      return Value != 0 && (Value & (Value - 1)) == 0;
+    }
+
+    // Allocate `Size` bytes aligned to `Alignment` from `TargetHeap`. Alignments up to the base alignment
+    // are served by Heap::Allocate, bigger ones by Heap::AllocateAligned, or by padding with runtimes that
+    // predate it.
+    inline void* AllocateAligned(Heap* TargetHeap, size_t Size, size_t Alignment) {
+      if (Alignment <= HeapBaseAlignment)
+        return TargetHeap->Allocate(Size);
+      return HeapAllocateAligned(TargetHeap, Size, Alignment);
+    }
+
+    // Release memory obtained from AllocateAligned. `Alignment` must match the value used to allocate.
+    inline void DeAllocateAligned(Heap* TargetHeap, void* Pointer, size_t Alignment) {
+      if (Pointer == nullptr)
+        return;
+
+      if (Alignment <= HeapBaseAlignment)
+        TargetHeap->DeAllocate(Pointer);
+      else
+        HeapDeAllocateAligned(TargetHeap, Pointer);
+    }
+
+    // Index of the calling thread, assigned round-robin on first use and shared by all sharded heaps.
+    inline size_t& CurrentThreadSlot() {
+      static std::atomic<size_t> s_NextSlot{0};
+      thread_local size_t t_Slot = s_NextSlot.fetch_add(1, std::memory_order_relaxed);
+      return t_Slot;
+    }
+
+    // Lock-free queue of pointers, used to hand frees to the shard that owns the memory. Pointers are kept
+    // in a bounded ring buffer, which spills into a lock-free list once it is full. The queue lives in
+    // regular memory, so pushing a pointer never touches the protected allocation itself.
+    class RemoteFreeQueue {
+    public:
+      enum : size_t { Capacity = 1024 };
+
+      RemoteFreeQueue() {
+        for (size_t i = 0; i < Capacity; ++i)
+          m_Cells[i].Sequence.store(i, std::memory_order_relaxed);
+      }
+
+      ~RemoteFreeQueue() {
+        OverflowNode* Node = m_Overflow.load(std::memory_order_relaxed);
+        while (Node != nullptr) {
+          OverflowNode* Next = Node->Next;
+          delete Node;
+          Node = Next;
+        }
+      }
+
+      // Queue `Value` without waiting. Fails only if the ring buffer is full and no memory is left to
+      // extend the list.
+      bool Push(void* Value) {
+        if (TryPush(Value))
+          return true;
+
+        OverflowNode* Node = new (std::nothrow) OverflowNode{Value, m_Overflow.load(std::memory_order_relaxed)};
+        if (Node == nullptr)
+          return false;
+        while (!m_Overflow.compare_exchange_weak(Node->Next, Node, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        return true;
+      }
+
+      // Call `Visit` with every queued pointer. The list is taken as a whole, so nodes are never popped
+      // individually and the list is not subject to ABA.
+      template <typename F>
+      void Drain(F&& Visit) {
+        void* Value;
+        while (TryPop(Value))
+          Visit(Value);
+
+        OverflowNode* Node = m_Overflow.exchange(nullptr, std::memory_order_acquire);
+        while (Node != nullptr) {
+          OverflowNode* Next = Node->Next;
+          Visit(Node->Value);
+          delete Node;
+          Node = Next;
+        }
+      }
+
+      bool TryPush(void* Value) {
+        size_t Position = m_Tail.load(std::memory_order_relaxed);
+        for (;;) {
+          Cell& Current = m_Cells[Position % Capacity];
+          const size_t Sequence = Current.Sequence.load(std::memory_order_acquire);
+          const intptr_t Difference = static_cast<intptr_t>(Sequence) - static_cast<intptr_t>(Position);
+          if (Difference == 0) {
+            if (m_Tail.compare_exchange_weak(Position, Position + 1, std::memory_order_relaxed)) {
+              Current.Value = Value;
+              Current.Sequence.store(Position + 1, std::memory_order_release);
+              return true;
+            }
+          } else if (Difference < 0) {
+            return false;
+          } else {
+            Position = m_Tail.load(std::memory_order_relaxed);
+          }
+        }
+      }
+
+      bool TryPop(void*& Value) {
+        size_t Position = m_Head.load(std::memory_order_relaxed);
+        for (;;) {
+          Cell& Current = m_Cells[Position % Capacity];
+          const size_t Sequence = Current.Sequence.load(std::memory_order_acquire);
+          const intptr_t Difference = static_cast<intptr_t>(Sequence) - static_cast<intptr_t>(Position + 1);
+          if (Difference == 0) {
+            if (m_Head.compare_exchange_weak(Position, Position + 1, std::memory_order_relaxed)) {
+              Value = Current.Value;
+              Current.Sequence.store(Position + Capacity, std::memory_order_release);
+              return true;
+            }
+          } else if (Difference < 0) {
+            return false;
+          } else {
+            Position = m_Head.load(std::memory_order_relaxed);
+          }
+        }
+      }
+
+    private:
+      struct Cell {
+        std::atomic<size_t> Sequence;
+        void* Value;
+      };
+
+      struct OverflowNode {
+        void* Value;
+        OverflowNode* Next;
+      };
+
+      Cell m_Cells[Capacity];
+      char m_PaddingTail[64];
+      std::atomic<size_t> m_Tail{0};
+      char m_PaddingHead[64];
+      std::atomic<size_t> m_Head{0};
+      std::atomic<OverflowNode*> m_Overflow{nullptr};
+    };
+
+    // Header in front of every allocation of a heap that serves memory from several backing heaps, recording
+    // the backing heap that owns the allocation and the distance to the start of the backing allocation.
+    struct OwnerHeader {
+      uint32_t Owner;
+      uint32_t Offset;
+      uint64_t Reserved;
+    };
+    static_assert(sizeof(OwnerHeader) == 16, "OwnerHeader must preserve the 16 byte alignment of allocations");
+
+    // Write the header for an allocation starting `Offset` bytes into `Base`, and return the allocation.
+    inline void* PlaceOwnerHeader(void* Base, size_t Offset, size_t Owner) {
+      void* Pointer = static_cast<uint8_t*>(Base) + Offset;
+      OwnerHeader* Header = static_cast<OwnerHeader*>(Pointer) - 1;
+      Header->Owner = static_cast<uint32_t>(Owner);
+      Header->Offset = static_cast<uint32_t>(Offset);
+      Header->Reserved = 0;
+      return Pointer;
+    }
+
+    inline const OwnerHeader& GetOwnerHeader(const void* Pointer) {
+      return *(static_cast<const OwnerHeader*>(Pointer) - 1);
+    }
+
+    // Start of the backing allocation of `Pointer`.
+    inline void* GetOwnerBase(void* Pointer) {
+      return static_cast<uint8_t*>(Pointer) - GetOwnerHeader(Pointer).Offset;
+    }
+
+    // Lock-free map from 64kB address granules to the owner of the allocations starting in them. Protected
+    // heaps reserve their memory in whole granules, so the allocations starting in a granule usually share
+    // one owner, which is then found without touching the allocation. Granules that hold allocations of
+    // several owners at once, e.g. of the CRT-backed dummy heap, are marked as shared, and the owner is read
+    // from the OwnerHeader of the allocation instead. Every granule counts the allocations starting in it,
+    // and is released once they are all unregistered.
+    class ShardDirectory {
+    public:
+      enum : size_t {
+        Invalid = static_cast<size_t>(-1),
+        GranuleShift = 16,
+        LeafBits = 16,
+        RootBits = 16,
+      };
+
+      struct Leaf {
+        // owner field in the low 16 bits (0 for none, SharedOwner for several, the owner + 1 otherwise), and
+        // the count of allocations starting in the granule in the high 16 bits
+        std::atomic<uint32_t> Entries[size_t(1) << LeafBits];
+      };
+
+      ShardDirectory() {
+        for (auto& Root : m_Leaves)
+          Root.store(nullptr, std::memory_order_relaxed);
+      }
+
+      ~ShardDirectory() {
+        for (auto& Root : m_Leaves)
+          delete Root.load(std::memory_order_relaxed);
+      }
+
+      // Make sure that `Spare` holds a leaf, so that the next call to Register passing it cannot fail.
+      static bool Reserve(Leaf*& Spare) {
+        if (Spare == nullptr)
+          Spare = new (std::nothrow) Leaf();
+        return Spare != nullptr;
+      }
+
+      // Record that the allocation `Pointer` belongs to `Owner`. If memory for the directory is exhausted,
+      // the leaf in `Spare` is used, if any.
+      bool Register(const void* Pointer, size_t Owner, Leaf*& Spare) {
+        std::atomic<uint32_t>* Entry = Lookup(reinterpret_cast<uintptr_t>(Pointer) >> GranuleShift, &Spare);
+        if (Entry == nullptr)
+          return false;
+
+        const uint32_t Field = static_cast<uint32_t>(Owner + 1);
+        uint32_t Value = Entry->load(std::memory_order_relaxed);
+        for (;;) {
+          const uint32_t Current = Value & FieldMask;
+          const uint32_t Next = Current == 0 || Current == Field ? Field : SharedOwner;
+          if (Entry->compare_exchange_weak(Value, (Value & ~FieldMask) + CountOne + Next, std::memory_order_relaxed))
+            return true;
+        }
+      }
+
+      // Remove the record of the allocation `Pointer` before it is released.
+      void Unregister(const void* Pointer) {
+        std::atomic<uint32_t>* Entry = Lookup(reinterpret_cast<uintptr_t>(Pointer) >> GranuleShift, nullptr);
+        if (Entry == nullptr)
+          return;
+
+        uint32_t Value = Entry->load(std::memory_order_relaxed);
+        for (;;) {
+          const uint32_t Next = Value - CountOne < CountOne ? 0 : Value - CountOne;
+          if (Entry->compare_exchange_weak(Value, Next, std::memory_order_relaxed))
+            return;
+        }
+      }
+
+      // Return the owner that `Pointer` was registered for, or `Invalid`.
+      size_t Find(const void* Pointer) {
+        std::atomic<uint32_t>* Entry = Lookup(reinterpret_cast<uintptr_t>(Pointer) >> GranuleShift, nullptr);
+        const uint32_t Field = Entry != nullptr ? Entry->load(std::memory_order_relaxed) & FieldMask : 0;
+        if (Field == SharedOwner)
+          return GetOwnerHeader(Pointer).Owner;
+        return Field != 0 ? static_cast<size_t>(Field - 1) : static_cast<size_t>(Invalid);
+      }
+
+    private:
+      enum : uint32_t {
+        FieldMask = 0xFFFF,
+        SharedOwner = 0xFFFF,
+        CountOne = 0x10000,
+      };
+
+      // Find the entry of `Granule`. Missing leaves are created if `Spare` is given.
+      std::atomic<uint32_t>* Lookup(uint64_t Granule, Leaf** Spare) {
+        const uint64_t Root = Granule >> LeafBits;
+        if (Root >= (uint64_t(1) << RootBits))
+          return nullptr;
+
+        Leaf* Current = m_Leaves[Root].load(std::memory_order_acquire);
+        if (Current == nullptr) {
+          if (Spare == nullptr)
+            return nullptr;
+
+          Leaf* NewLeaf = new (std::nothrow) Leaf();
+          if (NewLeaf == nullptr) {
+            NewLeaf = *Spare;
+            *Spare = nullptr;
+          }
+          if (NewLeaf == nullptr)
+            return nullptr;
+
+          if (m_Leaves[Root].compare_exchange_strong(Current, NewLeaf, std::memory_order_acq_rel))
+            Current = NewLeaf;
+          else if (*Spare == nullptr)
+            *Spare = NewLeaf;
+          else
+            delete NewLeaf;
+        }
+        return &Current->Entries[Granule & ((uint64_t(1) << LeafBits) - 1)];
+      }
+
+      std::atomic<Leaf*> m_Leaves[size_t(1) << RootBits];
+    };
+  } // namespace detail
+} // namespace THEIA_REAL_NAMESPACE
+
+namespace THEIA_REAL_NAMESPACE {
+  /// @brief A C++ Allocator serving allocations from a Theia protected heap.
+  ///
+  /// This allows standard containers such as @c std::vector or @c std::unordered_map to place their
+  /// storage on a protected heap without manual placement new. Alignments above the 16 bytes guaranteed
+  /// by the heap are served by Heap::AllocateAligned, or by padding the allocation with runtimes predating
+  /// interface version 3.
+  ///
+  /// @note The same rules apply as for using the heap directly: every operation on a container using this
+  ///       allocator that may allocate, deallocate or access its elements must happen inside the critical
+  ///       section of the heap. This includes destroying the container.
+  ///
+  /// @note Failed allocations throw @c std::bad_alloc, as required by the Allocator concept. If exceptions
+  ///       are disabled, the process is aborted instead.
+  template <typename T>
+  class HeapAllocator {
+  public:
+    using value_type = T;
+
+    /// @brief Create an allocator serving allocations from `TargetHeap`.
+    explicit HeapAllocator(Heap* TargetHeap) noexcept
+      : m_Heap(TargetHeap) {}
+
+    /// @brief Rebinding constructor, required by the Allocator concept.
+    template <typename U>
+    HeapAllocator(const HeapAllocator<U>& Other) noexcept
+      : m_Heap(Other.GetHeap()) {}
+
+    /// @brief Allocate uninitialized storage for `Count` objects of type `T`.
+    T* allocate(size_t Count) {
+      if (Count > static_cast<size_t>(-1) / sizeof(T))
+        THEIA_THROW_BAD_ALLOC();
+
+      void* Pointer = detail::AllocateAligned(m_Heap, Count * sizeof(T), alignof(T));
+      if (Pointer == nullptr)
+        THEIA_THROW_BAD_ALLOC();
+      return static_cast<T*>(Pointer);
+    }
+
+    /// @brief Release storage previously obtained from @c allocate.
+    void deallocate(T* Pointer, size_t /* Count */) noexcept {
+      detail::DeAllocateAligned(m_Heap, Pointer, alignof(T));
+    }
+
+    /// @brief The heap that serves allocations for this allocator.
+    Heap* GetHeap() const noexcept {
+      return m_Heap;
+    }
+
+  private:
+    Heap* m_Heap;
+  };
+
+  template <typename T, typename U>
+  bool operator==(const HeapAllocator<T>& Lhs, const HeapAllocator<U>& Rhs) noexcept {
+    return Lhs.GetHeap() == Rhs.GetHeap();
+  }
+
+  template <typename T, typename U>
+  bool operator!=(const HeapAllocator<T>& Lhs, const HeapAllocator<U>& Rhs) noexcept {
+    return !(Lhs == Rhs);
+  }
+
+  /// @brief A size-class allocator serving small allocations from slabs carved out of a protected heap.
+  ///
+  /// Every call to Heap::Allocate on a protected heap is a virtual call into the Theia runtime. For
+  /// workloads that make many small allocations, this overhead quickly adds up. The SlabHeap avoids it
+  /// by allocating large chunks from a backing heap, and serving allocations of up to @c MaxSlabAllocSize
+  /// bytes from per-size-class freelists within those chunks. Bigger allocations are forwarded to the
+  /// backing heap.
+  ///
+  /// @note Measure with `theia_slab_heap_benchmark` before adopting it, as the savings depend on the cost of
+  ///       the backing heap's allocator.
+  ///
+  /// The SlabHeap is itself a Heap, and can be used anywhere a Heap is expected. Its critical section is
+  /// the critical section of the backing heap: @c lock and @c unlock are forwarded to the backing heap, and
+  /// all rules on critical sections of the backing heap apply to the SlabHeap as well.
+  ///
+  /// @note Chunks are only returned to the backing heap once the SlabHeap is destroyed. Memory freed into a
+  ///       size class can only be reused by allocations of that same size class.
+  ///
+  /// @note Allocations larger than @c MaxSlabAllocSize are owned by the backing heap, and are not released
+  ///       when the SlabHeap is destroyed. Free them before destroying the SlabHeap.
+  class SlabHeap final : public Heap {
+  public:
+    enum : size_t {
+      /// @brief Size difference between two consecutive size classes, and the alignment of all allocations.
+      ClassGranularity = detail::HeapBaseAlignment,
+
+      /// @brief Largest allocation served from the slabs.
+      MaxSlabAllocSize = 256,
+
+      /// @brief Amount of size classes.
+      ClassCount = MaxSlabAllocSize / ClassGranularity,
+
+      /// @brief Default amount of bytes allocated from the backing heap for each chunk.
+      DefaultChunkSize = 0x10000,
+    };
+
+    /// @brief Create a new SlabHeap on top of `BackingHeap`.
+    ///
+    /// The SlabHeap does not take ownership of the backing heap, which must outlive the SlabHeap. The
+    /// returned heap must be destroyed using @c Destroy.
+    ///
+    /// @param BackingHeap Heap to allocate chunks and large allocations from.
+    /// @param ChunkSize Count of bytes to allocate from the backing heap at once. Must be at least
+    ///                  @c MaxSlabAllocSize and no larger than the `MaxAllocSize` of the backing heap.
+    /// @return Pointer to the new heap, or @c nullptr if the parameters are invalid or allocation failed.
+    static SlabHeap* Create(Heap* BackingHeap, size_t ChunkSize = DefaultChunkSize) {
+      if (BackingHeap == nullptr || ChunkSize < MaxSlabAllocSize)
+        return nullptr;
+      return new (std::nothrow) SlabHeap(BackingHeap, ChunkSize);
+    }
+
+    /// @brief Release all chunks to the backing heap and destroy the SlabHeap.
+    ///
+    /// This enters the critical section of the backing heap to release the chunks, and therefore must
+    /// be called outside the critical section.
+    void Destroy() noexcept override {
+      m_BackingHeap->lock();
+      for (const uintptr_t Begin : m_ChunkBegins)
+        m_BackingHeap->DeAllocate(reinterpret_cast<void*>(Begin));
+      m_BackingHeap->unlock();
+      delete this;
+    }
+
+    void* Allocate(size_t Size) override {
+      if (Size > MaxSlabAllocSize)
+        return m_BackingHeap->Allocate(Size);
+
+      const size_t ClassIndex = Size != 0 ? (Size - 1) / ClassGranularity : 0;
+      SizeClass& Class = m_Classes[ClassIndex];
+      if (Class.FreeList != nullptr) {
+        void* Pointer = Class.FreeList;
+        Class.FreeList = *static_cast<void**>(Pointer);
+        return Pointer;
+      }
+
+      if (Class.Cursor == Class.End && !Refill(ClassIndex))
+        return nullptr;
+
+      void* Pointer = Class.Cursor;
+      Class.Cursor += ClassSize(ClassIndex);
+      return Pointer;
+    }
+
+    bool DeAllocate(void* Pointer) override {
+      if (Pointer == nullptr)
+        return true;
+
+      const size_t Owner = FindChunk(Pointer);
+      if (Owner == static_cast<size_t>(-1))
+        return m_BackingHeap->DeAllocate(Pointer);
+
+      SizeClass& Class = m_Classes[m_ChunkClasses[Owner]];
+      *static_cast<void**>(Pointer) = Class.FreeList;
+      Class.FreeList = Pointer;
+      return true;
+    }
+
+    void lock() override {
+      m_BackingHeap->lock();
+    }
+
+    void unlock() override {
+      m_BackingHeap->unlock();
+    }
+
+    void* GetBackingHeap() override {
+      return m_BackingHeap->GetBackingHeap();
+    }
+
+    void* ReAllocate(void* Pointer, size_t Size) override {
+      if (Pointer == nullptr)
+        return Allocate(Size);
+
+      const size_t Owner = FindChunk(Pointer);
+      if (Owner == static_cast<size_t>(-1)) {
+        if (Size > MaxSlabAllocSize)
+          return m_BackingHeap->ReAllocate(Pointer, Size);
+
+        // shrinking a large allocation into a size class
+        void* Result = Allocate(Size);
+        if (Result != nullptr) {
+          std::memcpy(Result, Pointer, Size);
+          m_BackingHeap->DeAllocate(Pointer);
+        }
+        return Result;
+      }
+
+      const size_t OldSize = ClassSize(m_ChunkClasses[Owner]);
+      if (Size <= OldSize && Size > OldSize - ClassGranularity)
+        return Pointer;
+
+      void* Result = Allocate(Size);
+      if (Result != nullptr) {
+        std::memcpy(Result, Pointer, Size < OldSize ? Size : OldSize);
+        DeAllocate(Pointer);
+      }
+      return Result;
+    }
+
+    size_t GetSize(void* Pointer) override {
+      if (Pointer == nullptr)
+        return 0;
+
+      const size_t Owner = FindChunk(Pointer);
+      return Owner != static_cast<size_t>(-1) ? ClassSize(m_ChunkClasses[Owner]) : m_BackingHeap->GetSize(Pointer);
+    }
+
+    /// @brief Over-aligned allocations are always forwarded to the backing heap.
+    void* AllocateAligned(size_t Size, size_t Alignment) override {
+      return HeapAllocateAligned(m_BackingHeap, Size, Alignment);
+    }
+
+    bool DeAllocateAligned(void* Pointer) override {
+      return HeapDeAllocateAligned(m_BackingHeap, Pointer);
+    }
+
+    size_t GetAlignedSize(void* Pointer) override {
+      return HeapGetAlignedSize(m_BackingHeap, Pointer);
+    }
+
+    /// @brief Allocate `Count` objects of the same size class, see Heap::AllocateBatch.
+    ///
+    /// Large allocations are forwarded to the backing heap as a single batch.
+    bool AllocateBatch(size_t Size, size_t Count, void** Pointers) override {
+      if (Size > MaxSlabAllocSize)
+        return HeapAllocateBatch(m_BackingHeap, Size, Count, Pointers);
+
+      for (size_t i = 0; i < Count; ++i) {
+        Pointers[i] = Allocate(Size);
+        if (Pointers[i] == nullptr) {
+          DeAllocateBatch(Pointers, i);
+          std::fill(Pointers, Pointers + Count, nullptr);
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /// @brief Deallocate `Count` objects, see Heap::DeAllocateBatch.
+    ///
+    /// Consecutive pointers from the same chunk are released without searching the chunk again, which
+    /// makes tearing down containers allocated in bulk considerably cheaper than separate calls.
+    bool DeAllocateBatch(void* const* Pointers, size_t Count) override {
+      bool Result = true;
+      uintptr_t ChunkBegin = 0;
+      SizeClass* Class = nullptr;
+      for (size_t i = 0; i < Count; ++i) {
+        void* Pointer = Pointers[i];
+        if (Pointer == nullptr)
+          continue;
+
+        if (Class == nullptr || reinterpret_cast<uintptr_t>(Pointer) - ChunkBegin >= m_ChunkSize) {
+          const size_t Owner = FindChunk(Pointer);
+          if (Owner == static_cast<size_t>(-1)) {
+            Result &= m_BackingHeap->DeAllocate(Pointer);
+            Class = nullptr;
+            continue;
+          }
+          ChunkBegin = m_ChunkBegins[Owner];
+          Class = &m_Classes[m_ChunkClasses[Owner]];
+        }
+
+        *static_cast<void**>(Pointer) = Class->FreeList;
+        Class->FreeList = Pointer;
+      }
+      return Result;
+    }
+
+    /// @brief Retrieve the statistics of the backing heap.
+    ///
+    /// Chunks count as in use as a whole, so @c BytesInUse and @c AllocationCount describe the chunks and
+    /// large allocations of this heap rather than individual small allocations.
+    size_t QueryStats(HeapStats* OutputBuffer) override {
+      return HeapQueryStats(m_BackingHeap, OutputBuffer);
+    }
+
+    /// @brief The heap that chunks and large allocations are allocated from.
+    Heap* GetParentHeap() const noexcept {
+      return m_BackingHeap;
+    }
+
+  private:
+    struct SizeClass {
+      void* FreeList = nullptr;
+      uint8_t* Cursor = nullptr;
+      uint8_t* End = nullptr;
+    };
+
+    SlabHeap(Heap* BackingHeap, size_t ChunkSize)
+      : m_BackingHeap(BackingHeap)
+      , m_ChunkSize(ChunkSize) {}
+
+    ~SlabHeap() override = default;
+
+    static constexpr size_t ClassSize(size_t ClassIndex) {
+      return (ClassIndex + 1) * ClassGranularity;
+    }
+
+    // Find the index of the chunk containing `Pointer`, or -1 if the pointer was allocated by the backing
+    // heap. This is a branchless binary search over the chunk addresses, which are kept sorted.
+    size_t FindChunk(const void* Pointer) const {
+      const uintptr_t Address = reinterpret_cast<uintptr_t>(Pointer);
+      if (m_ChunkBegins.empty())
+        return static_cast<size_t>(-1);
+
+      const uintptr_t* Base = m_ChunkBegins.data();
+      size_t Count = m_ChunkBegins.size();
+      while (Count > 1) {
+        const size_t Half = Count / 2;
+        Base = Base[Half] <= Address ? Base + Half : Base;
+        Count -= Half;
+      }
+      return Address - *Base < m_ChunkSize ? static_cast<size_t>(Base - m_ChunkBegins.data()) : static_cast<size_t>(-1);
+    }
+
+    // Make room to record one more chunk, so that recording it cannot throw out of Allocate.
+    bool ReserveChunk() {
+      if (m_ChunkBegins.size() < m_ChunkBegins.capacity() && m_ChunkClasses.size() < m_ChunkClasses.capacity())
+        return true;
+
+      const size_t Capacity = (std::max)(m_ChunkBegins.size() * 2, size_t(16));
+#if defined(THEIA_HAS_EXCEPTIONS)
+      try {
+        m_ChunkBegins.reserve(Capacity);
+        m_ChunkClasses.reserve(Capacity);
+      } catch (...) {
+        return false;
+      }
+#else
+      m_ChunkBegins.reserve(Capacity);
+      m_ChunkClasses.reserve(Capacity);
+#endif
+      return true;
+    }
+
+    // Allocate a new chunk from the backing heap and make it the bump region of the given class.
+    bool Refill(size_t ClassIndex) {
+      if (!ReserveChunk())
+        return false;
+
+      uint8_t* Memory = static_cast<uint8_t*>(m_BackingHeap->Allocate(m_ChunkSize));
+      if (Memory == nullptr)
+        return false;
+
+      const uintptr_t Begin = reinterpret_cast<uintptr_t>(Memory);
+      const auto It = std::upper_bound(m_ChunkBegins.begin(), m_ChunkBegins.end(), Begin);
+      m_ChunkClasses.insert(m_ChunkClasses.begin() + (It - m_ChunkBegins.begin()), static_cast<uint8_t>(ClassIndex));
+      m_ChunkBegins.insert(It, Begin);
+
+      SizeClass& Class = m_Classes[ClassIndex];
+      Class.Cursor = Memory;
+      Class.End = Memory + m_ChunkSize / ClassSize(ClassIndex) * ClassSize(ClassIndex);
+      return true;
+    }
+
+    Heap* m_BackingHeap;
+    size_t m_ChunkSize;
+    SizeClass m_Classes[ClassCount];
+
+    // start addresses of all chunks in ascending order, and the size class served by each of them
+    std::vector<uintptr_t> m_ChunkBegins;
+    std::vector<uint8_t> m_ChunkClasses;
+  };
+
+  /// @brief A protected heap split into independently locked shards, for use by many threads at once.
+  ///
+  /// A single protected heap has no synchronization of its own, so threads sharing it must serialize on
+  /// a mutex around its critical section. The ShardedHeap instead creates one protected heap per shard,
+  /// each guarded by its own mutex. Every thread is assigned a shard: calling @c lock enters the
+  /// critical section of the shard of the calling thread, and @c Allocate serves memory from that shard.
+  ///
+  /// Freeing memory that was allocated by another shard is supported without entering the critical
+  /// section of that shard. Such frees are pushed onto a lock-free queue owned by the other shard, which
+  /// releases them the next time it is locked. The owning shard is recorded in a 16 byte header in front
+  /// of every allocation, and in a directory kept in regular memory. The memory itself is only touched by
+  /// the freeing thread if the shards share address ranges, as the CRT-backed dummy heap does.
+  ///
+  /// Threads are assigned to shards round-robin on first use. Threads that should share a shard (e.g. a
+  /// group of workers operating on the same data) can be bound to the same slot with @c BindCurrentThread.
+  ///
+  /// @note Locking a shard only allows access to the memory of that shard. Accessing memory allocated by
+  ///       another shard requires entering its critical section with @c LockShard. Consequently,
+  ///       @c ReAllocate, @c GetSize and @c GetAlignedSize fail for memory owned by another shard.
+  ///
+  /// @note The same thread must not change its slot while it is inside the critical section.
+  class ShardedHeap final : public Heap {
+  public:
+    enum : size_t {
+      /// @brief Largest supported amount of shards.
+      MaxShardCount = 255,
+
+      /// @brief Returned by @c FindShard for memory that was not allocated by this heap.
+      InvalidShard = detail::ShardDirectory::Invalid,
+    };
+
+    /// @brief Create a new ShardedHeap with the given amount of shards.
+    ///
+    /// Each shard is a protected heap created using @c FunctionPtrs::CreateHeap with the given
+    /// `ReservedSize` and `MaxAllocSize`. The returned heap must be destroyed using @c Destroy.
+    ///
+    /// @param ShardCount Amount of shards, or @c 0 to create one shard per hardware thread.
+    /// @param ReservedSize Count of bytes to reserve for each shard.
+    /// @param MaxAllocSize Count of bytes for maximum allowed allocation size or @c 0 for any size.
+    /// @return Pointer to the new heap, or @c nullptr if creating any of the shards failed.
+    static ShardedHeap* Create(size_t ShardCount, size_t ReservedSize, size_t MaxAllocSize) {
+      if (ShardCount == 0)
+        ShardCount = (std::max)(static_cast<size_t>(std::thread::hardware_concurrency()), static_cast<size_t>(1));
+      if (ShardCount > MaxShardCount)
+        return nullptr;
+
+      ShardedHeap* Result = new (std::nothrow) ShardedHeap();
+      if (Result == nullptr)
+        return nullptr;
+
+      Result->m_Shards = new (std::nothrow) Shard[ShardCount];
+      if (Result->m_Shards == nullptr) {
+        delete Result;
+        return nullptr;
+      }
+
+      for (; Result->m_ShardCount < ShardCount; ++Result->m_ShardCount) {
+        Heap* NewHeap = GetInterface()->CreateHeap(ReservedSize, BackingMaxAllocSize(MaxAllocSize), nullptr);
+        if (NewHeap == nullptr) {
+          Result->Destroy();
+          return nullptr;
+        }
+        Result->m_Shards[Result->m_ShardCount].Backing = NewHeap;
+      }
+      return Result;
+    }
+
+    /// @brief Release all pending remote frees, destroy all shards and destroy the ShardedHeap.
+    ///
+    /// This must be called outside the critical section of every shard.
+    void Destroy() noexcept override {
+      for (size_t i = 0; i < m_ShardCount; ++i) {
+        LockShard(i);
+        UnlockShard(i);
+        m_Shards[i].Backing->Destroy();
+      }
+      delete this;
+    }
+
+    /// @brief Allocate memory from the shard of the calling thread.
+    ///
+    /// @note Calling this function outside the critical section of the calling thread is undefined behavior.
+    void* Allocate(size_t Size) override {
+      if (Size > static_cast<size_t>(-1) - HeaderSize)
+        return nullptr;
+
+      const size_t Index = CurrentShardIndex();
+      Shard& Own = m_Shards[Index];
+      void* Base = Own.Backing->Allocate(Size + HeaderSize);
+      if (Base == nullptr)
+        return nullptr;
+
+      void* Pointer = detail::PlaceOwnerHeader(Base, HeaderSize, Index);
+      if (!m_Directory.Register(Pointer, Index, Own.Spare)) {
+        Own.Backing->DeAllocate(Base);
+        return nullptr;
+      }
+      return Pointer;
+    }
+
+    /// @brief Deallocate memory allocated by any shard of this heap.
+    ///
+    /// Memory owned by the shard of the calling thread is released immediately. Memory owned by another
+    /// shard is queued, and released the next time that shard is locked.
+    ///
+    /// @note Calling this function outside the critical section of the calling thread is undefined behavior.
+    bool DeAllocate(void* Pointer) override {
+      if (Pointer == nullptr)
+        return true;
+
+      const size_t Owner = m_Directory.Find(Pointer);
+      if (Owner == InvalidShard)
+        return false;
+
+      m_Directory.Unregister(Pointer);
+      if (Owner == CurrentShardIndex())
+        return m_Shards[Owner].Backing->DeAllocate(detail::GetOwnerBase(Pointer));
+
+      FreeRemote(Owner, Pointer);
+      return true;
+    }
+
+    /// @brief Enter the critical section of the shard of the calling thread.
+    ///
+    /// Unlike a plain Heap, this blocks while another thread is inside the critical section of the same shard.
+    void lock() override {
+      LockShard(CurrentShardIndex());
+    }
+
+    /// @brief Leave the critical section of the shard of the calling thread.
+    void unlock() override {
+      UnlockShard(CurrentShardIndex());
+    }
+
+    void* GetBackingHeap() override {
+      return m_Shards[CurrentShardIndex()].Backing->GetBackingHeap();
+    }
+
+    /// @brief Reallocate memory owned by the shard of the calling thread.
+    ///
+    /// @return The reallocated memory, or @c nullptr if reallocation failed or `Pointer` is owned by another shard.
+    void* ReAllocate(void* Pointer, size_t Size) override {
+      if (Pointer == nullptr)
+        return Allocate(Size);
+
+      const size_t Index = CurrentShardIndex();
+      if (m_Directory.Find(Pointer) != Index || Size > static_cast<size_t>(-1) - HeaderSize)
+        return nullptr;
+
+      // once the block has moved, it must be registered at its new address, which the spare leaf guarantees
+      Shard& Own = m_Shards[Index];
+      if (!detail::ShardDirectory::Reserve(Own.Spare))
+        return nullptr;
+
+      void* Base = Own.Backing->ReAllocate(detail::GetOwnerBase(Pointer), Size + HeaderSize);
+      if (Base == nullptr)
+        return nullptr;
+
+      void* Result = static_cast<uint8_t*>(Base) + HeaderSize;
+      if (Result != Pointer) {
+        m_Directory.Unregister(Pointer);
+        m_Directory.Register(Result, Index, Own.Spare);
+      }
+      return Result;
+    }
+
+    /// @brief Retrieve the size of memory owned by the shard of the calling thread.
+    ///
+    /// @return Allocation size of `Pointer`, or @c -1 if not supported or `Pointer` is owned by another shard.
+    size_t GetSize(void* Pointer) override {
+      if (Pointer == nullptr)
+        return 0;
+
+      const size_t Index = CurrentShardIndex();
+      if (m_Directory.Find(Pointer) != Index)
+        return static_cast<size_t>(-1);
+
+      const size_t Size = m_Shards[Index].Backing->GetSize(detail::GetOwnerBase(Pointer));
+      return Size != static_cast<size_t>(-1) ? Size - HeaderSize : Size;
+    }
+
+    /// @brief Allocate over-aligned memory from the shard of the calling thread.
+    void* AllocateAligned(size_t Size, size_t Alignment) override {
+      const size_t Offset = (std::max)(Alignment, static_cast<size_t>(HeaderSize));
+      if (Size > static_cast<size_t>(-1) - Offset)
+        return nullptr;
+
+      const size_t Index = CurrentShardIndex();
+      Shard& Own = m_Shards[Index];
+      void* Base = HeapAllocateAligned(Own.Backing, Size + Offset, Alignment);
+      if (Base == nullptr)
+        return nullptr;
+
+      void* Pointer = detail::PlaceOwnerHeader(Base, Offset, Index);
+      if (!m_Directory.Register(Pointer, Index, Own.Spare)) {
+        HeapDeAllocateAligned(Own.Backing, Base);
+        return nullptr;
+      }
+      return Pointer;
+    }
+
+    /// @brief Deallocate over-aligned memory allocated by any shard of this heap, see @c DeAllocate.
+    bool DeAllocateAligned(void* Pointer) override {
+      if (Pointer == nullptr)
+        return true;
+
+      const size_t Owner = m_Directory.Find(Pointer);
+      if (Owner == InvalidShard)
+        return false;
+
+      m_Directory.Unregister(Pointer);
+      if (Owner == CurrentShardIndex())
+        return HeapDeAllocateAligned(m_Shards[Owner].Backing, detail::GetOwnerBase(Pointer));
+
+      FreeRemote(Owner, reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(Pointer) | AlignedTag));
+      return true;
+    }
+
+    /// @brief Retrieve the size of over-aligned memory owned by the shard of the calling thread.
+    ///
+    /// @return Allocation size of `Pointer`, or @c -1 if not supported or `Pointer` is owned by another shard.
+    size_t GetAlignedSize(void* Pointer) override {
+      if (Pointer == nullptr)
+        return 0;
+
+      const size_t Index = CurrentShardIndex();
+      if (m_Directory.Find(Pointer) != Index)
+        return static_cast<size_t>(-1);
+
+      const size_t Size = HeapGetAlignedSize(m_Shards[Index].Backing, detail::GetOwnerBase(Pointer));
+      return Size != static_cast<size_t>(-1) ? Size - detail::GetOwnerHeader(Pointer).Offset : Size;
+    }
+
+    /// @brief Allocate `Count` objects from the shard of the calling thread, see Heap::AllocateBatch.
+    bool AllocateBatch(size_t Size, size_t Count, void** Pointers) override {
+      if (Size > static_cast<size_t>(-1) - HeaderSize) {
+        std::fill(Pointers, Pointers + Count, nullptr);
+        return false;
+      }
+
+      const size_t Index = CurrentShardIndex();
+      Shard& Own = m_Shards[Index];
+      if (!HeapAllocateBatch(Own.Backing, Size + HeaderSize, Count, Pointers))
+        return false;
+
+      for (size_t i = 0; i < Count; ++i) {
+        Pointers[i] = detail::PlaceOwnerHeader(Pointers[i], HeaderSize, Index);
+        if (!m_Directory.Register(Pointers[i], Index, Own.Spare)) {
+          for (size_t j = 0; j < i; ++j)
+            m_Directory.Unregister(Pointers[j]);
+          for (size_t j = 0; j <= i; ++j)
+            Pointers[j] = detail::GetOwnerBase(Pointers[j]);
+          HeapDeAllocateBatch(Own.Backing, Pointers, Count);
+          std::fill(Pointers, Pointers + Count, nullptr);
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /// @brief Retrieve the statistics of the shard of the calling thread.
+    ///
+    /// Statistics of other shards can be retrieved with @c QueryShardStats.
+    size_t QueryStats(HeapStats* OutputBuffer) override {
+      return HeapQueryStats(m_Shards[CurrentShardIndex()].Backing, OutputBuffer);
+    }
+
+    /// @brief Retrieve the statistics of the given shard.
+    ///
+    /// @note Calling this function outside the critical section of the given shard is undefined behavior.
+    size_t QueryShardStats(size_t Index, HeapStats* OutputBuffer) {
+      return HeapQueryStats(m_Shards[Index].Backing, OutputBuffer);
+    }
+
+    /// @brief Amount of shards in this heap.
+    size_t GetShardCount() const noexcept {
+      return m_ShardCount;
+    }
+
+    /// @brief The shard that owns the given allocation, or @c InvalidShard if not allocated by this heap.
+    size_t FindShard(const void* Pointer) {
+      return m_Directory.Find(Pointer);
+    }
+
+    /// @brief The shard used by the calling thread.
+    size_t CurrentShardIndex() const noexcept {
+      return detail::CurrentThreadSlot() % m_ShardCount;
+    }
+
+    /// @brief Enter the critical section of the given shard, blocking until it is available.
+    ///
+    /// This allows a thread to access memory owned by another shard. Pending remote frees for the shard
+    /// are released before returning.
+    ///
+    /// @warning To avoid deadlocks, a thread holding multiple shards at once must always lock them in
+    ///          ascending order of their index.
+    void LockShard(size_t Index) {
+      Shard& Target = m_Shards[Index];
+      Target.Mutex.lock();
+      Target.Backing->lock();
+      DrainRemoteFrees(Target);
+    }
+
+    /// @brief Leave the critical section of the given shard.
+    void UnlockShard(size_t Index) {
+      Shard& Target = m_Shards[Index];
+      Target.Backing->unlock();
+      Target.Mutex.unlock();
+    }
+
+    /// @brief Assign the calling thread to the given slot.
+    ///
+    /// Threads bound to the same slot share a shard in every ShardedHeap. By default, every thread
+    /// receives its own slot on first use.
+    static void BindCurrentThread(size_t Slot) noexcept {
+      detail::CurrentThreadSlot() = Slot;
+    }
+
+  private:
+    struct Shard {
+      Heap* Backing = nullptr;
+      std::mutex Mutex;
+      detail::RemoteFreeQueue RemoteFrees;
+      detail::ShardDirectory::Leaf* Spare = nullptr;
+
+      ~Shard() {
+        delete Spare;
+      }
+    };
+
+    enum : size_t {
+      HeaderSize = sizeof(detail::OwnerHeader),
+    };
+
+    ShardedHeap() = default;
+
+    ~ShardedHeap() override {
+      delete[] m_Shards;
+    }
+
+    // Remote frees of over-aligned memory are queued with the lowest bit set, which is always clear in
+    // pointers returned by the heap.
+    static constexpr uintptr_t AlignedTag = 1;
+
+    // Backing heaps also hold the OwnerHeader of every allocation.
+    static size_t BackingMaxAllocSize(size_t MaxAllocSize) {
+      return MaxAllocSize == 0 || MaxAllocSize > static_cast<size_t>(-1) - HeaderSize ? 0 : MaxAllocSize + HeaderSize;
+    }
+
+    static void ReleaseQueued(Shard& Target, void* Pointer) {
+      const uintptr_t Value = reinterpret_cast<uintptr_t>(Pointer);
+      if (Value & AlignedTag)
+        HeapDeAllocateAligned(Target.Backing, detail::GetOwnerBase(reinterpret_cast<void*>(Value & ~AlignedTag)));
+      else
+        Target.Backing->DeAllocate(detail::GetOwnerBase(Pointer));
+    }
+
+    void DrainRemoteFrees(Shard& Target) {
+      Target.RemoteFrees.Drain([&](void* Pointer) { ReleaseQueued(Target, Pointer); });
+    }
+
+    // Hand `Pointer` to its owning shard. The queue of the shard never fills up, so the owner is not
+    // waited on, and threads freeing into each other's shards can not deadlock. Only if memory for the
+    // queue is exhausted, the pointer is released directly. Before waiting for the owner, the calling
+    // thread then leaves the critical section of its own shard, so that two threads can never wait for
+    // each other.
+    void FreeRemote(size_t Owner, void* Pointer) {
+      Shard& Target = m_Shards[Owner];
+      if (Target.RemoteFrees.Push(Pointer))
+        return;
+
+      const size_t Own = CurrentShardIndex();
+      const bool Waits = !Target.Mutex.try_lock();
+      if (Waits) {
+        UnlockShard(Own);
+        Target.Mutex.lock();
+      }
+      Target.Backing->lock();
+      DrainRemoteFrees(Target);
+      ReleaseQueued(Target, Pointer);
+      Target.Backing->unlock();
+      Target.Mutex.unlock();
+      if (Waits)
+        LockShard(Own);
+    }
+
+    Shard* m_Shards = nullptr;
+    size_t m_ShardCount = 0;
+    detail::ShardDirectory m_Directory;
+  };
+
+  /// @brief A protected heap that grows by chaining additional protected heaps when it is full.
+  ///
+  /// A protected heap reserves its full capacity when it is created, and cannot grow afterwards. The
+  /// SegmentedHeap instead starts with a single, small segment created using @c FunctionPtrs::CreateHeap,
+  /// and creates another segment whenever an allocation does not fit into any of the existing ones. Each
+  /// new segment reserves twice as much memory as the previous one, so few segments are needed even for
+  /// heaps that grow large.
+  ///
+  /// Entering the critical section of the SegmentedHeap enters the critical section of every segment, and
+  /// memory can be freed through the SegmentedHeap regardless of the segment it was allocated from. The
+  /// owning segment of a pointer is found in constant time using a directory of 64kB address granules, or
+  /// the 16 byte header in front of every allocation if segments share a granule. Freed allocations are
+  /// removed from the directory, so granules can be reused by other segments.
+  ///
+  /// @note Segments are never released before the SegmentedHeap is destroyed, even if they become empty.
+  class SegmentedHeap final : public Heap {
+  public:
+    enum : size_t {
+      /// @brief Largest supported amount of segments.
+      MaxSegmentCount = 255,
+    };
+
+    /// @brief Create a new SegmentedHeap.
+    ///
+    /// The returned heap must be destroyed using @c Destroy.
+    ///
+    /// @param InitialSize Count of bytes to reserve for the first segment.
+    /// @param MaxAllocSize Count of bytes for maximum allowed allocation size or @c 0 for any size.
+    /// @param MaxReservedSize Count of bytes that all segments may reserve in total, or @c 0 for no limit.
+    /// @return Pointer to the new heap, or @c nullptr if creating the first segment failed.
+    static SegmentedHeap* Create(size_t InitialSize, size_t MaxAllocSize, size_t MaxReservedSize = 0) {
+      if (InitialSize == 0 || (MaxReservedSize != 0 && InitialSize > MaxReservedSize))
+        return nullptr;
+
+      SegmentedHeap* Result = new (std::nothrow) SegmentedHeap(MaxAllocSize, MaxReservedSize);
+      if (Result == nullptr)
+        return nullptr;
+
+      if (!Result->AddSegment(InitialSize)) {
+        delete Result;
+        return nullptr;
+      }
+      return Result;
+    }
+
+    /// @brief Destroy all segments and the SegmentedHeap.
+    ///
+    /// This must be called outside the critical section.
+    void Destroy() noexcept override {
+      for (size_t i = 0; i < m_SegmentCount; ++i)
+        m_Segments[i]->Destroy();
+      delete this;
+    }
+
+    /// @brief Allocate memory from any segment, creating a new segment if none of them has enough space.
+    void* Allocate(size_t Size) override {
+      if (Size > static_cast<size_t>(-1) - HeaderSize)
+        return nullptr;
+      return AllocateWith(Size, Size + HeaderSize, HeaderSize, false, [Size](Heap* Segment) {
+        return Segment->Allocate(Size + HeaderSize);
+      });
+    }
+
+    bool DeAllocate(void* Pointer) override {
+      if (Pointer == nullptr)
+        return true;
+
+      const size_t Owner = m_Directory.Find(Pointer);
+      if (Owner == detail::ShardDirectory::Invalid)
+        return false;
+
+      m_Directory.Unregister(Pointer);
+      return m_Segments[Owner]->DeAllocate(detail::GetOwnerBase(Pointer));
+    }
+
+    /// @brief Enter the critical section of all segments.
+    void lock() override {
+      for (size_t i = 0; i < m_SegmentCount; ++i)
+        m_Segments[i]->lock();
+      m_Locked = true;
+    }
+
+    /// @brief Leave the critical section of all segments.
+    void unlock() override {
+      m_Locked = false;
+      for (size_t i = m_SegmentCount; i-- > 0;)
+        m_Segments[i]->unlock();
+    }
+
+    /// @brief Returns the native handle of the first segment.
+    void* GetBackingHeap() override {
+      return m_Segments[0]->GetBackingHeap();
+    }
+
+    /// @brief Reallocate memory, moving it to another segment if its own segment is full.
+    void* ReAllocate(void* Pointer, size_t Size) override {
+      if (Pointer == nullptr)
+        return Allocate(Size);
+
+      const size_t Owner = m_Directory.Find(Pointer);
+      if (Owner == detail::ShardDirectory::Invalid || Size > static_cast<size_t>(-1) - HeaderSize)
+        return nullptr;
+
+      // once the block has moved, it must be registered at its new address, which the spare leaf guarantees
+      if (!detail::ShardDirectory::Reserve(m_Spare))
+        return nullptr;
+
+      Heap* Segment = m_Segments[Owner];
+      void* Base = Segment->ReAllocate(detail::GetOwnerBase(Pointer), Size + HeaderSize);
+      if (Base != nullptr) {
+        void* Result = static_cast<uint8_t*>(Base) + HeaderSize;
+        if (Result != Pointer) {
+          m_Directory.Unregister(Pointer);
+          m_Directory.Register(Result, Owner, m_Spare);
+        }
+        return Result;
+      }
+
+      const size_t OldSize = GetSize(Pointer);
+      if (OldSize == static_cast<size_t>(-1))
+        return nullptr;
+
+      void* Result = Allocate(Size);
+      if (Result != nullptr) {
+        std::memcpy(Result, Pointer, (std::min)(OldSize, Size));
+        DeAllocate(Pointer);
+      }
+      return Result;
+    }
+
+    size_t GetSize(void* Pointer) override {
+      if (Pointer == nullptr)
+        return 0;
+
+      const size_t Owner = m_Directory.Find(Pointer);
+      if (Owner == detail::ShardDirectory::Invalid)
+        return static_cast<size_t>(-1);
+
+      const size_t Size = m_Segments[Owner]->GetSize(detail::GetOwnerBase(Pointer));
+      return Size != static_cast<size_t>(-1) ? Size - HeaderSize : Size;
+    }
+
+    void* AllocateAligned(size_t Size, size_t Alignment) override {
+      const size_t Offset = (std::max)(Alignment, static_cast<size_t>(HeaderSize));
+      if (Alignment > static_cast<size_t>(-1) / 4 || Size > static_cast<size_t>(-1) - Offset - Alignment)
+        return nullptr;
+      return AllocateWith(Size, Size + Offset + Alignment, Offset, true, [Size, Offset, Alignment](Heap* Segment) {
+        return HeapAllocateAligned(Segment, Size + Offset, Alignment);
+      });
+    }
+
+    bool DeAllocateAligned(void* Pointer) override {
+      if (Pointer == nullptr)
+        return true;
+
+      const size_t Owner = m_Directory.Find(Pointer);
+      if (Owner == detail::ShardDirectory::Invalid)
+        return false;
+
+      m_Directory.Unregister(Pointer);
+      return HeapDeAllocateAligned(m_Segments[Owner], detail::GetOwnerBase(Pointer));
+    }
+
+    size_t GetAlignedSize(void* Pointer) override {
+      if (Pointer == nullptr)
+        return 0;
+
+      const size_t Owner = m_Directory.Find(Pointer);
+      if (Owner == detail::ShardDirectory::Invalid)
+        return static_cast<size_t>(-1);
+
+      const size_t Size = HeapGetAlignedSize(m_Segments[Owner], detail::GetOwnerBase(Pointer));
+      return Size != static_cast<size_t>(-1) ? Size - detail::GetOwnerHeader(Pointer).Offset : Size;
+    }
+
+    /// @brief Retrieve the combined statistics of all segments.
+    ///
+    /// Byte and allocation counts, as well as durations, are summed up over all segments. The peak usage
+    /// is the sum of the peaks of all segments, and therefore an upper bound. Lock counts are those of the
+    /// first segment, which has been locked as often as the SegmentedHeap itself.
+    size_t QueryStats(HeapStats* OutputBuffer) override {
+      if (OutputBuffer->BufferSize != sizeof(HeapStats))
+        return (size_t)-1;
+
+      HeapStats Total;
+      for (size_t i = 0; i < m_SegmentCount; ++i) {
+        HeapStats Segment;
+        if (HeapQueryStats(m_Segments[i], &Segment) != 0)
+          return (size_t)-1;
+
+        Total.BytesInUse += Segment.BytesInUse;
+        Total.PeakBytesInUse += Segment.PeakBytesInUse;
+        Total.BytesCommitted += Segment.BytesCommitted;
+        Total.BytesReserved += Segment.BytesReserved;
+        Total.LargestFreeBlock = (std::max)(Total.LargestFreeBlock, Segment.LargestFreeBlock);
+        Total.AllocationCount += Segment.AllocationCount;
+        Total.LockNanoseconds += Segment.LockNanoseconds;
+        Total.UnlockNanoseconds += Segment.UnlockNanoseconds;
+        if (i == 0) {
+          Total.LockCount = Segment.LockCount;
+          Total.UnlockCount = Segment.UnlockCount;
+        }
+      }
+      *OutputBuffer = Total;
+      return 0;
+    }
+
+    /// @brief Amount of segments in this heap.
+    size_t GetSegmentCount() const noexcept {
+      return m_SegmentCount;
+    }
+
+    /// @brief Count of bytes reserved by all segments together.
+    size_t GetReservedSize() const noexcept {
+      return m_ReservedSize;
+    }
+
+  private:
+    SegmentedHeap(size_t MaxAllocSize, size_t MaxReservedSize)
+      : m_MaxAllocSize(MaxAllocSize)
+      , m_MaxReservedSize(MaxReservedSize) {}
+
+    ~SegmentedHeap() override {
+      delete m_Spare;
+    }
+
+    enum : size_t {
+      HeaderSize = sizeof(detail::OwnerHeader),
+    };
+
+    // Serve an allocation of `Size` bytes using `Allocator`, trying the segment that served the last
+    // allocation first, then all other segments, and finally a new segment. `Footprint` is the amount of
+    // bytes the allocation may take up within a segment, and the allocation starts `Offset` bytes into the
+    // memory returned by `Allocator`, behind its OwnerHeader.
+    template <typename F>
+    void* AllocateWith(size_t Size, size_t Footprint, size_t Offset, bool Aligned, F Allocator) {
+      if (m_MaxAllocSize != 0 && Size > m_MaxAllocSize)
+        return nullptr;
+
+      for (size_t i = 0; i < m_SegmentCount; ++i) {
+        const size_t Index = (m_Current + i) % m_SegmentCount;
+        void* Base = Allocator(m_Segments[Index]);
+        if (Base != nullptr)
+          return Register(Base, Offset, Index, Aligned);
+      }
+
+      // a new segment reserves at least twice the footprint, so that its bookkeeping fits as well, but no
+      // more than MaxReservedSize allows. Allocations that would not fit fail without creating a segment.
+      size_t NextSize = (std::max)(SaturatingDouble(m_SegmentSizes[m_SegmentCount - 1]), SaturatingDouble(Footprint));
+      if (m_MaxReservedSize != 0)
+        NextSize = (std::min)(NextSize, m_MaxReservedSize - m_ReservedSize);
+      if (Footprint >= NextSize || !AddSegment(NextSize))
+        return nullptr;
+
+      void* Base = Allocator(m_Segments[m_SegmentCount - 1]);
+      return Base != nullptr ? Register(Base, Offset, m_SegmentCount - 1, Aligned) : nullptr;
+    }
+
+    static size_t SaturatingDouble(size_t Value) {
+      return Value > static_cast<size_t>(-1) / 2 ? static_cast<size_t>(-1) : Value * 2;
+    }
+
+    void* Register(void* Base, size_t Offset, size_t Index, bool Aligned) {
+      void* Pointer = detail::PlaceOwnerHeader(Base, Offset, Index);
+      if (!m_Directory.Register(Pointer, Index, m_Spare)) {
+        if (Aligned)
+          HeapDeAllocateAligned(m_Segments[Index], Base);
+        else
+          m_Segments[Index]->DeAllocate(Base);
+        return nullptr;
+      }
+      m_Current = Index;
+      return Pointer;
+    }
+
+    // Create a segment reserving up to `ReservedSize` bytes, entering its critical section if the heap is
+    // currently locked.
+    bool AddSegment(size_t ReservedSize) {
+      if (m_SegmentCount == MaxSegmentCount)
+        return false;
+      if (m_MaxReservedSize != 0)
+        ReservedSize = (std::min)(ReservedSize, m_MaxReservedSize - m_ReservedSize);
+      if (ReservedSize == 0)
+        return false;
+
+      // segments also hold the OwnerHeader of every allocation
+      const size_t SegmentMaxAllocSize = m_MaxAllocSize == 0 || m_MaxAllocSize > static_cast<size_t>(-1) - HeaderSize ? 0 : m_MaxAllocSize + HeaderSize;
+      Heap* Segment = GetInterface()->CreateHeap(ReservedSize, SegmentMaxAllocSize, nullptr);
+      if (Segment == nullptr)
+        return false;
+      if (m_Locked)
+        Segment->lock();
+
+      m_Segments[m_SegmentCount] = Segment;
+      m_SegmentSizes[m_SegmentCount] = ReservedSize;
+      m_ReservedSize += ReservedSize;
+      ++m_SegmentCount;
+      return true;
+    }
+
+    size_t m_MaxAllocSize;
+    size_t m_MaxReservedSize;
+    size_t m_ReservedSize = 0;
+    size_t m_SegmentCount = 0;
+    size_t m_Current = 0;
+    bool m_Locked = false;
+    Heap* m_Segments[MaxSegmentCount]{};
+    size_t m_SegmentSizes[MaxSegmentCount]{};
+    detail::ShardDirectory m_Directory;
+    detail::ShardDirectory::Leaf* m_Spare = nullptr;
+  };
+
+  /// @brief A pool of objects of a single type, stored in slabs on a protected heap.
+  ///
+  /// Objects are placed in slots within slabs of @c ObjectsPerSlab objects each, which are allocated from
+  /// the heap as needed. Destroyed objects return their slot to an intrusive freelist, so creating and
+  /// destroying objects takes constant time and does not call into the heap.
+  ///
+  /// Every slot has a stable index, which remains valid for the lifetime of the object and can be stored
+  /// instead of a pointer, e.g. in handles passed outside of the critical section. Use @c IndexOf and
+  /// @c At to convert between objects and their indices.
+  ///
+  /// All bookkeeping lives in the slabs themselves, so every member function of the pool, including its
+  /// destructor, must be called inside the critical section of the heap.
+  ///
+  /// @note The pool keeps its slabs until it is cleared or destroyed, even if all of their objects have
+  ///       been destroyed.
+  template <typename T>
+  class ObjectPool {
+  public:
+    /// @brief Stable index of an object in the pool.
+    using Index = uint32_t;
+
+    enum : Index {
+      /// @brief Index that never refers to an object.
+      InvalidIndex = static_cast<Index>(-1),
+    };
+
+    /// @brief Create an empty pool that allocates its slabs from `TargetHeap`.
+    ///
+    /// @param TargetHeap Heap to allocate slabs from, which must outlive the pool.
+    /// @param ObjectsPerSlab Count of objects per slab, or @c 0 to fit slabs into roughly 64kB.
+    explicit ObjectPool(Heap* TargetHeap, size_t ObjectsPerSlab = 0)
+      : m_Heap(TargetHeap)
+      , m_ObjectsPerSlab(ObjectsPerSlab != 0 ? ObjectsPerSlab : (std::max)(DefaultSlabSize / SlotSize, static_cast<size_t>(1))) {}
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    /// @brief Destroy all objects and release all slabs.
+    ~ObjectPool() {
+      Clear();
+    }
+
+    /// @brief Construct a new object in the pool.
+    ///
+    /// @return Pointer to the new object, or @c nullptr if allocating a new slab failed.
+    template <typename... Args>
+    T* Create(Args&&... Arguments) {
+      Slot* Target = AcquireSlot();
+      if (Target == nullptr)
+        return nullptr;
+
+      // the slot returns to the freelist if the constructor throws
+      struct ReleaseGuard {
+        ObjectPool* Pool;
+        Slot* Target;
+        ~ReleaseGuard() {
+          if (Target != nullptr)
+            Pool->ReleaseSlot(Target);
+        }
+      } Guard{this, Target};
+
+      T* Result = ::new (Target->Storage()) T(std::forward<Args>(Arguments)...);
+      Guard.Target = nullptr;
+      Target->Next = LiveMarker;
+      ++m_LiveCount;
+      return Result;
+    }
+
+    /// @brief Destroy an object created by this pool.
+    void Destroy(T* Object) {
+      if (Object == nullptr)
+        return;
+
+      Object->~T();
+      ReleaseSlot(Slot::FromObject(Object));
+      --m_LiveCount;
+    }
+
+    /// @brief Destroy the object with the given index, if it is alive.
+    void DestroyAt(Index ObjectIndex) {
+      Destroy(At(ObjectIndex));
+    }
+
+    /// @brief The stable index of an object created by this pool.
+    Index IndexOf(const T* Object) const {
+      return Slot::FromObject(Object)->SlotIndex;
+    }
+
+    /// @brief The object with the given index, or @c nullptr if the index does not refer to a live object.
+    T* At(Index ObjectIndex) const {
+      if (ObjectIndex >= m_UsedSlots)
+        return nullptr;
+
+      Slot* Target = SlotAt(ObjectIndex);
+      return Target->Next == LiveMarker ? static_cast<T*>(Target->Storage()) : nullptr;
+    }
+
+    /// @brief Invoke `Function` with a reference to every live object, in the order of their indices.
+    ///
+    /// `Function` may destroy the object it is invoked with, but must not create new objects.
+    template <typename F>
+    void ForEach(F&& Function) {
+      for (Index i = 0; i < m_UsedSlots; ++i) {
+        Slot* Target = SlotAt(i);
+        if (Target->Next == LiveMarker)
+          Function(*static_cast<T*>(Target->Storage()));
+      }
+    }
+
+    /// @brief Destroy all objects and release all slabs to the heap.
+    void Clear() {
+      ForEach([this](T& Object) {
+        Destroy(&Object);
+      });
+
+      for (uint8_t* Slab : m_Slabs)
+        detail::DeAllocateAligned(m_Heap, Slab, SlotAlignment);
+      m_Slabs.clear();
+      m_FreeList = InvalidIndex;
+      m_UsedSlots = 0;
+    }
+
+    /// @brief Count of live objects.
+    size_t Size() const noexcept {
+      return m_LiveCount;
+    }
+
+    /// @brief Count of objects the pool can hold without allocating another slab.
+    size_t Capacity() const noexcept {
+      return m_Slabs.size() * m_ObjectsPerSlab;
+    }
+
+  private:
+    // Slots start with a header holding the index of the slot, and either the index of the next free
+    // slot or LiveMarker while the slot holds an object.
+    struct Slot {
+      Index SlotIndex;
+      Index Next;
+
+      void* Storage() {
+        return reinterpret_cast<uint8_t*>(this) + HeaderSize;
+      }
+
+      static Slot* FromObject(const T* Object) {
+        return reinterpret_cast<Slot*>(reinterpret_cast<uint8_t*>(const_cast<T*>(Object)) - HeaderSize);
+      }
+    };
+
+    static constexpr size_t SlotAlignment = (std::max)(alignof(T), alignof(Slot));
+    static constexpr size_t HeaderSize = (sizeof(Slot) + alignof(T) - 1) / alignof(T) * alignof(T);
+    static constexpr size_t SlotSize = (HeaderSize + sizeof(T) + SlotAlignment - 1) / SlotAlignment * SlotAlignment;
+    static constexpr size_t DefaultSlabSize = 0x10000;
+    static constexpr Index LiveMarker = static_cast<Index>(-2);
+
+    Slot* SlotAt(Index SlotIndex) const {
+      return reinterpret_cast<Slot*>(m_Slabs[SlotIndex / m_ObjectsPerSlab] + (SlotIndex % m_ObjectsPerSlab) * SlotSize);
+    }
+
+    // Take a slot from the freelist, from the unused part of the last slab, or from a new slab.
+    Slot* AcquireSlot() {
+      if (m_FreeList != InvalidIndex) {
+        Slot* Target = SlotAt(m_FreeList);
+        m_FreeList = Target->Next;
+        return Target;
+      }
+
+      if (m_UsedSlots == Capacity()) {
+        if (Capacity() + m_ObjectsPerSlab > LiveMarker)
+          return nullptr;
+
+        if (!ReserveSlab())
+          return nullptr;
+        void* Slab = detail::AllocateAligned(m_Heap, m_ObjectsPerSlab * SlotSize, SlotAlignment);
+        if (Slab == nullptr)
+          return nullptr;
+        m_Slabs.push_back(static_cast<uint8_t*>(Slab));
+      }
+
+      Slot* Target = SlotAt(static_cast<Index>(m_UsedSlots));
+      Target->SlotIndex = static_cast<Index>(m_UsedSlots++);
+      return Target;
+    }
+
+    void ReleaseSlot(Slot* Target) {
+      Target->Next = m_FreeList;
+      m_FreeList = Target->SlotIndex;
+    }
+
+    // Make room to record one more slab, so that recording it cannot throw out of Create.
+    bool ReserveSlab() {
+      if (m_Slabs.size() < m_Slabs.capacity())
+        return true;
+
+      const size_t Capacity = (std::max)(m_Slabs.size() * 2, size_t(16));
+#if defined(THEIA_HAS_EXCEPTIONS)
+      try {
+        m_Slabs.reserve(Capacity);
+      } catch (...) {
+        return false;
+      }
+#else
+      m_Slabs.reserve(Capacity);
+#endif
+      return true;
+    }
+
+    Heap* m_Heap;
+    size_t m_ObjectsPerSlab;
+    size_t m_UsedSlots = 0;
+    size_t m_LiveCount = 0;
+    Index m_FreeList = InvalidIndex;
+
+    // start addresses of all slabs, in the order of the indices they hold
+    std::vector<uint8_t*> m_Slabs;
+  };
+
+  /// @brief Handle to an object allocated from a RelocatableHeap.
+  ///
+  /// Unlike a pointer, a handle remains valid when the object is moved by compaction. It can only be
+  /// resolved to a pointer inside the critical section, using @c RelocatableHeap::Resolve.
+  template <typename T>
+  class HeapHandle {
+  public:
+    HeapHandle() = default;
+
+    /// @brief Whether this handle was returned by a successful allocation.
+    explicit operator bool() const noexcept {
+      return m_Generation != 0;
+    }
+
+    bool operator==(const HeapHandle& Other) const noexcept {
+      return m_Index == Other.m_Index && m_Generation == Other.m_Generation;
+    }
+
+    bool operator!=(const HeapHandle& Other) const noexcept {
+      return !(*this == Other);
+    }
+
+  private:
+    friend class RelocatableHeap;
+
+    HeapHandle(uint32_t Index, uint32_t Generation)
+      : m_Index(Index)
+      , m_Generation(Generation) {}
+
+    uint32_t m_Index = 0;
+    uint32_t m_Generation = 0;
+  };
+
+  /// @brief A handle-based allocator on top of a protected heap, whose free space can be compacted.
+  ///
+  /// A protected heap can not move allocations, so long-running processes can fragment it to the point
+  /// where allocations fail although plenty of memory is free. The RelocatableHeap instead hands out
+  /// @c HeapHandle values, and keeps the pointer behind each handle in a handle table. This allows
+  /// @c Compact to move objects towards the start of the region, closing the gaps left by freed objects.
+  ///
+  /// The RelocatableHeap serves objects from a single region of `Capacity` bytes, which is allocated from
+  /// the backing heap on first use. New objects are placed after the last object in the region, and
+  /// space of freed objects is only reclaimed by compaction. Compaction is incremental: each call to
+  /// @c Compact moves objects until the given time budget is exhausted, and the next call resumes where
+  /// the previous one stopped. Objects can be allocated and freed between the steps of a compaction pass.
+  ///
+  /// Objects are moved using @c memmove, so only trivially copyable types can be stored. Pointers returned
+  /// by @c Resolve are invalidated by @c Compact and when leaving the critical section.
+  ///
+  /// @note All member functions, including the destructor, must be called inside the critical section
+  ///       of the backing heap.
+  class RelocatableHeap {
+  public:
+    /// @brief Create a RelocatableHeap using `Capacity` bytes of `BackingHeap`.
+    ///
+    /// @param BackingHeap Heap to allocate the region from, which must outlive the RelocatableHeap.
+    /// @param Capacity Count of bytes of the region, including a 16 byte header per object.
+    RelocatableHeap(Heap* BackingHeap, size_t Capacity)
+      : m_Heap(BackingHeap)
+      , m_Capacity(Capacity & ~(size_t(Granularity) - 1)) {}
+
+    RelocatableHeap(const RelocatableHeap&) = delete;
+    RelocatableHeap& operator=(const RelocatableHeap&) = delete;
+
+    /// @brief Release the region to the backing heap. Remaining objects are not destroyed.
+    ~RelocatableHeap() {
+      if (m_Region != nullptr)
+        m_Heap->DeAllocate(m_Region);
+    }
+
+    /// @brief Allocate `Size` bytes.
+    ///
+    /// @return Handle to the allocation, or an empty handle if the region has no space left after the last
+    ///         object. In the latter case, compaction may make enough space available again.
+    HeapHandle<void> Allocate(size_t Size) {
+      if (m_Region == nullptr) {
+        m_Region = static_cast<uint8_t*>(m_Heap->Allocate(m_Capacity));
+        if (m_Region == nullptr)
+          return {};
+      }
+
+      if (Size > m_Capacity - sizeof(BlockHeader))
+        return {};
+      const size_t BlockSize = sizeof(BlockHeader) + ((Size + Granularity - 1) & ~(size_t(Granularity) - 1));
+      if (BlockSize > m_Capacity - m_Top)
+        return {};
+
+      uint32_t Index;
+      if (m_FreeHandle != NoHandle) {
+        Index = m_FreeHandle;
+        m_FreeHandle = m_Handles[Index].NextFree;
+      } else {
+        if (m_Handles.size() == NoHandle || !ReserveHandle())
+          return {};
+        Index = static_cast<uint32_t>(m_Handles.size());
+        m_Handles.push_back(HandleEntry{});
+      }
+
+      BlockHeader* Block = reinterpret_cast<BlockHeader*>(m_Region + m_Top);
+      Block->Size = BlockSize;
+      Block->Handle = Index;
+      m_Top += BlockSize;
+      m_LiveBytes += BlockSize;
+
+      HandleEntry& Entry = m_Handles[Index];
+      Entry.Payload = reinterpret_cast<uint8_t*>(Block + 1);
+      Entry.NextFree = NoHandle;
+      return HeapHandle<void>(Index, Entry.Generation);
+    }
+
+    /// @brief Allocate and construct an object of type `T`.
+    ///
+    /// @return Handle to the new object, or an empty handle if allocation failed.
+    template <typename T, typename... Args>
+    HeapHandle<T> New(Args&&... Arguments) {
+      static_assert(std::is_trivially_copyable<T>::value, "objects of a RelocatableHeap are moved with memmove");
+      static_assert(alignof(T) <= Granularity, "objects of a RelocatableHeap are aligned to 16 bytes");
+
+      const HeapHandle<void> Result = Allocate(sizeof(T));
+      if (!Result)
+        return {};
+      ::new (Resolve(Result)) T(std::forward<Args>(Arguments)...);
+      return HeapHandle<T>(Result.m_Index, Result.m_Generation);
+    }
+
+    /// @brief Free the allocation behind `Handle`. Empty and stale handles are ignored.
+    template <typename T>
+    void Free(HeapHandle<T> Handle) {
+      BlockHeader* Block = BlockOf(Handle.m_Index, Handle.m_Generation);
+      if (Block == nullptr)
+        return;
+
+      HandleEntry& Entry = m_Handles[Handle.m_Index];
+      Entry.Payload = nullptr;
+      Entry.NextFree = m_FreeHandle;
+      if (++Entry.Generation == 0)
+        Entry.Generation = 1;
+      m_FreeHandle = Handle.m_Index;
+
+      Block->Handle = NoHandle;
+      m_LiveBytes -= Block->Size;
+
+      // outside of a compaction pass, space at the end of the region is reclaimed immediately
+      if (!m_Compacting && reinterpret_cast<uint8_t*>(Block) + Block->Size == m_Region + m_Top)
+        m_Top -= Block->Size;
+    }
+
+    /// @brief Resolve a handle to a pointer.
+    ///
+    /// @return The object behind `Handle`, or @c nullptr if the handle is empty or its object was freed.
+    template <typename T>
+    T* Resolve(HeapHandle<T> Handle) const {
+      BlockHeader* Block = BlockOf(Handle.m_Index, Handle.m_Generation);
+      return Block != nullptr ? reinterpret_cast<T*>(Block + 1) : nullptr;
+    }
+
+    /// @brief Move objects towards the start of the region, until compaction finishes or `Budget` elapses.
+    ///
+    /// A compaction pass walks the region once, moving every live object directly behind the previous
+    /// one. If the budget elapses before the pass finishes, the next call continues it.
+    ///
+    /// @return @c true if the compaction pass finished, @c false if it must be continued.
+    bool Compact(std::chrono::microseconds Budget) {
+      if (m_Region == nullptr)
+        return true;
+
+      const auto Deadline = std::chrono::steady_clock::now() + Budget;
+      if (!m_Compacting) {
+        m_Compacting = true;
+        m_CompactTop = 0;
+        m_Scan = 0;
+      }
+
+      while (m_Scan < m_Top) {
+        BlockHeader* Block = reinterpret_cast<BlockHeader*>(m_Region + m_Scan);
+        const size_t BlockSize = Block->Size;
+        if (Block->Handle != NoHandle) {
+          if (m_CompactTop != m_Scan) {
+            std::memmove(m_Region + m_CompactTop, Block, BlockSize);
+            m_Handles[reinterpret_cast<BlockHeader*>(m_Region + m_CompactTop)->Handle].Payload = m_Region + m_CompactTop + sizeof(BlockHeader);
+          }
+          m_CompactTop += BlockSize;
+        }
+        m_Scan += BlockSize;
+
+        if (m_CompactTop != m_Scan) {
+          // keep the region walkable by covering the space between both cursors with a free block
+          BlockHeader* Gap = reinterpret_cast<BlockHeader*>(m_Region + m_CompactTop);
+          Gap->Size = m_Scan - m_CompactTop;
+          Gap->Handle = NoHandle;
+        }
+
+        if (m_Scan < m_Top && std::chrono::steady_clock::now() >= Deadline)
+          return false;
+      }
+
+      m_Top = m_CompactTop;
+      m_Compacting = false;
+      return true;
+    }
+
+    /// @brief Count of bytes used by live objects, including their headers.
+    size_t GetLiveBytes() const noexcept {
+      return m_LiveBytes;
+    }
+
+    /// @brief Count of bytes after the last object, which are available to @c Allocate.
+    size_t GetAvailableBytes() const noexcept {
+      return m_Capacity - m_Top;
+    }
+
+    /// @brief Count of bytes held by freed objects that compaction can reclaim.
+    size_t GetFragmentedBytes() const noexcept {
+      return m_Top - m_LiveBytes;
+    }
+
+  private:
+    enum : uint32_t {
+      Granularity = 16,
+      NoHandle = static_cast<uint32_t>(-1),
+    };
+
+    // Header in front of every object in the region. Freed objects keep their header with Handle set to
+    // NoHandle, so that the region can be walked from its start.
+    struct BlockHeader {
+      size_t Size;
+      uint32_t Handle;
+      uint32_t Unused;
+    };
+
+    struct HandleEntry {
+      uint8_t* Payload = nullptr;
+      uint32_t Generation = 1;
+      uint32_t NextFree = NoHandle;
+    };
+
+    // Make room for one more handle, so that adding it cannot throw out of Allocate.
+    bool ReserveHandle() {
+      if (m_Handles.size() < m_Handles.capacity())
+        return true;
+
+      const size_t Capacity = (std::max)(m_Handles.size() * 2, size_t(16));
+#if defined(THEIA_HAS_EXCEPTIONS)
+      try {
+        m_Handles.reserve(Capacity);
+      } catch (...) {
+        return false;
+      }
+#else
+      m_Handles.reserve(Capacity);
+#endif
+      return true;
+    }
+
+    BlockHeader* BlockOf(uint32_t Index, uint32_t Generation) const {
+      if (Index >= m_Handles.size() || m_Handles[Index].Generation != Generation || m_Handles[Index].Payload == nullptr)
+        return nullptr;
+      return reinterpret_cast<BlockHeader*>(m_Handles[Index].Payload) - 1;
+    }
+
+    Heap* m_Heap;
+    size_t m_Capacity;
+    uint8_t* m_Region = nullptr;
+    size_t m_Top = 0;
+    size_t m_LiveBytes = 0;
+
+    bool m_Compacting = false;
+    size_t m_CompactTop = 0;
+    size_t m_Scan = 0;
+
+    // pointers behind all handles, and a freelist of unused entries
+    std::vector<HandleEntry> m_Handles;
+    uint32_t m_FreeHandle = NoHandle;
+  };
+
+  /// @brief Executes closures from many threads inside the critical section of a heap, in batches.
+  ///
+  /// Entering the critical section of a protected heap is comparatively expensive, because Theia checks
+  /// for memory accesses that happened since the last call to @c unlock. The HeapCombiner amortizes this
+  /// cost using flat combining: threads publish the operations they want to perform on the heap, and one
+  /// of the waiting threads becomes the combiner. The combiner enters the critical section once, runs all
+  /// published operations in the order they were submitted, and leaves the critical section again.
+  ///
+  /// The HeapCombiner also serializes all access to the heap, so it replaces a mutex around the heap. All
+  /// access to the heap must go through the combiner while it is in use.
+  ///
+  /// @note Operations run on whichever thread is the combiner at the time. They must not throw, and must
+  ///       not submit further operations to the same combiner.
+  class HeapCombiner {
+  public:
+    enum : size_t {
+      /// @brief Maximum amount of times a combiner collects newly published operations before leaving the
+      ///        critical section, so that a single thread is not kept combining indefinitely.
+      MaxCombinePasses = 4,
+    };
+
+    /// @brief Create a combiner for `TargetHeap`. The heap must outlive the combiner.
+    explicit HeapCombiner(Heap& TargetHeap) noexcept
+      : m_Heap(TargetHeap) {}
+
+    HeapCombiner(const HeapCombiner&) = delete;
+    HeapCombiner& operator=(const HeapCombiner&) = delete;
+
+    /// @brief Run all posted operations before destroying the combiner.
+    ~HeapCombiner() {
+      Flush();
+    }
+
+    /// @brief Run `Function` inside the critical section of the heap, and wait for it to complete.
+    ///
+    /// `Function` is invoked with a reference to the heap. If another thread is currently combining, this
+    /// waits for it to run `Function` as part of its batch. Otherwise, the calling thread becomes the
+    /// combiner and runs `Function` along with all other pending operations.
+    template <typename Fn>
+    void Execute(Fn&& Function) {
+      struct Callable {
+        static void Run(Request& Self, Heap& TargetHeap) {
+          (*static_cast<typename std::remove_reference<Fn>::type*>(Self.Context))(TargetHeap);
+        }
+      };
+
+      Request Own;
+      Own.Invoke = &Callable::Run;
+      Own.Context = const_cast<void*>(static_cast<const volatile void*>(&Function));
+      Publish(&Own);
+
+      while (!Own.Done.load(std::memory_order_acquire)) {
+        if (m_CombinerMutex.try_lock()) {
+          Combine();
+          m_CombinerMutex.unlock();
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    /// @brief Queue `Function` to run inside the critical section of the heap, without waiting for it.
+    ///
+    /// The operation runs as part of the next batch, i.e. during the next call to @c Execute or @c Flush
+    /// from any thread. The closure is copied into regular memory until then.
+    ///
+    /// @return @c false if no memory could be allocated for the operation.
+    template <typename Fn>
+    bool Post(Fn&& Function) {
+      using Closure = typename std::decay<Fn>::type;
+      struct Posted : Request {
+        explicit Posted(Fn&& Function)
+          : Stored(std::forward<Fn>(Function)) {}
+
+        static void Run(Request& Self, Heap& TargetHeap) {
+          Posted* Owned = static_cast<Posted*>(&Self);
+          Owned->Stored(TargetHeap);
+          delete Owned;
+        }
+
+        Closure Stored;
+      };
+
+      Posted* NewRequest = new (std::nothrow) Posted(std::forward<Fn>(Function));
+      if (NewRequest == nullptr)
+        return false;
+      NewRequest->Invoke = &Posted::Run;
+      NewRequest->Owned = true;
+      Publish(NewRequest);
+      return true;
+    }
+
+    /// @brief Run all pending operations, becoming the combiner if needed.
+    void Flush() {
+      m_CombinerMutex.lock();
+      Combine();
+      m_CombinerMutex.unlock();
+    }
+
+    /// @brief The heap whose critical section operations run in.
+    Heap& GetHeap() const noexcept {
+      return m_Heap;
+    }
+
+  private:
+    struct Request {
+      Request* Next = nullptr;
+      void (*Invoke)(Request& Self, Heap& TargetHeap) = nullptr;
+      void* Context = nullptr;
+      bool Owned = false;
+      std::atomic<bool> Done{false};
+    };
+
+    void Publish(Request* NewRequest) {
+      NewRequest->Next = m_Pending.load(std::memory_order_relaxed);
+      while (!m_Pending.compare_exchange_weak(NewRequest->Next, NewRequest, std::memory_order_release, std::memory_order_relaxed)) {
+      }
+    }
+
+    // Run all pending requests inside a single critical section. Must be called with the combiner mutex held.
+    void Combine() {
+      Request* Batch = m_Pending.exchange(nullptr, std::memory_order_acquire);
+      if (Batch == nullptr)
+        return;
+
+      size_t Passes = 0;
+      m_Heap.lock();
+      while (Batch != nullptr) {
+        // requests are published onto a stack, so reverse them to run in submission order
+        Request* Ordered = nullptr;
+        while (Batch != nullptr) {
+          Request* Next = Batch->Next;
+          Batch->Next = Ordered;
+          Ordered = Batch;
+          Batch = Next;
+        }
+
+        while (Ordered != nullptr) {
+          // the waiting thread may release its request as soon as it is marked done
+          // posted requests release themselves when invoked
+          Request* Next = Ordered->Next;
+          const bool Owned = Ordered->Owned;
+          Ordered->Invoke(*Ordered, m_Heap);
+          if (!Owned)
+            Ordered->Done.store(true, std::memory_order_release);
+          Ordered = Next;
+        }
+
+        // pick up requests published in the meantime, but bound the amount of work done by one combiner
+        if (++Passes == MaxCombinePasses)
+          break;
+        Batch = m_Pending.exchange(nullptr, std::memory_order_acquire);
+      }
+      m_Heap.unlock();
+    }
+
+    Heap& m_Heap;
+    std::mutex m_CombinerMutex;
+    std::atomic<Request*> m_Pending{nullptr};
+  };
+
+#if defined(THEIA_HAS_MEMORY_RESOURCE)
+  /// @brief A @c std::pmr::memory_resource serving allocations from a Theia protected heap.
+  ///
+  /// This allows any @c std::pmr container, e.g. @c std::pmr::vector, to place its storage on a protected
+  /// heap. Alignments above the 16 bytes guaranteed by the heap are served by Heap::AllocateAligned, or by
+  /// padding the allocation with runtimes predating interface version 3. Like the standard pool resources,
+  /// a resource only compares equal to itself, so that no RTTI is needed.
+  ///
+  /// @note Only available when compiling with C++17 or later.
+  ///
+  /// @note Every operation on a container using this resource that may allocate, deallocate or access its
+  ///       elements must happen inside the critical section of the heap. This includes destroying the
+  ///       container. The resource itself does not need to live on the heap.
+  class HeapResource final : public std::pmr::memory_resource {
+  public:
+    /// @brief Create a memory resource serving allocations from `TargetHeap`.
+    explicit HeapResource(Heap* TargetHeap) noexcept
+      : m_Heap(TargetHeap) {}
+
+    /// @brief The heap that serves allocations for this resource.
+    Heap* GetHeap() const noexcept {
+      return m_Heap;
+    }
+
+  private:
+    void* do_allocate(size_t Bytes, size_t Alignment) override {
+      void* Pointer = detail::AllocateAligned(m_Heap, Bytes, Alignment);
+      if (Pointer == nullptr)
+        THEIA_THROW_BAD_ALLOC();
+      return Pointer;
+    }
+
+    void do_deallocate(void* Pointer, size_t /* Bytes */, size_t Alignment) override {
+      detail::DeAllocateAligned(m_Heap, Pointer, Alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& Other) const noexcept override {
+      return this == &Other;
+    }
+
+    Heap* m_Heap;
+  };
+#endif
+} // namespace THEIA_REAL_NAMESPACE
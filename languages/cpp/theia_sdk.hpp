@@ -6,6 +6,9 @@
 /// Proprietary and confidential
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <type_traits>
@@ -66,7 +69,23 @@ namespace THEIA_REAL_NAMESPACE {
     THEIA_MAJOR_VERSION = 2,
 
     /// @brief The interface version for communication between the SDK and the runtime.
-    THEIA_INTERFACE_VERSION = 1,
+    ///
+    /// Version history:
+    /// - 1: Initial version.
+    /// - 2: The runtime reports its interface version, see GetRuntimeInterfaceVersion.
+    /// - 3: Added Heap::AllocateAligned, Heap::DeAllocateAligned and Heap::GetAlignedSize.
+    /// - 4: Added Heap::AllocateBatch and Heap::DeAllocateBatch.
+    /// - 5: Added Heap::QueryStats.
+    /// - 6: Added Heap::Snapshot and Heap::Restore.
+    /// - 7: FunctionPtrs::Encrypt accepts budgets in pages or microseconds, see THEIA_ENCRYPT_MICROSECONDS.
+    /// - 8: Added FunctionPtrs::EncryptAsync.
+    /// - 9: Added FunctionPtrs::PrefetchPages.
+    /// - 10: Added FunctionPtrs::PinPages, FunctionPtrs::UnpinPages and PageStats::CountPagesPinned.
+    /// - 11: Added per-page statistics to PageStats.
+    /// - 12: Added FunctionPtrs::QueryLatencyStats.
+    /// - 13: Added FunctionPtrs::FrameBegin and FunctionPtrs::FrameEnd.
+    /// - 14: Added the state of adaptive periodic re-encryption to PageStats.
+    THEIA_INTERFACE_VERSION = 14,
   };
 }
 namespace theia = THEIA_REAL_NAMESPACE;
@@ -83,6 +102,8 @@ namespace THEIA_REAL_NAMESPACE {
     };
 
     THEIA_EXPORT extern const FunctionPtrs* g_TheiaVMT;
+    THEIA_EXPORT extern uint32_t g_TheiaRuntimeVersion;
+    extern const FunctionPtrs* const g_TheiaDefaultVMT;
 
     THEIA_EXPORT extern const uint8_t g_DataBlob[0x2000];
     THEIA_EXPORT extern const uint8_t g_RdataBlob[0x2000];
@@ -131,6 +152,13 @@ namespace THEIA_REAL_NAMESPACE {
 
     enum class AllCrashSentinel { SubscribeToAllCrashes };
     enum class AllTelemetrySentinel { SubscribeToAllTelemetryNotifications };
+
+    // whether all given types are function types
+    template <typename... F>
+    struct AllFunctions : std::true_type {};
+
+    template <typename F, typename... Rest>
+    struct AllFunctions<F, Rest...> : std::integral_constant<bool, std::is_function<F>::value && AllFunctions<Rest...>::value> {};
   } // namespace detail
 } // namespace THEIA_REAL_NAMESPACE
 
@@ -825,6 +853,85 @@ namespace THEIA_REAL_NAMESPACE {
   ///                or the specific NTSTATUS itself.
 #define THEIA_REGISTER_CALLBACK(Function, ForWhat) THEIA_REGISTER_CALLBACK_IMPL(THEIA_CONCAT(_theia_CT, __LINE__), Function, ForWhat)
 
+  /// @brief Values for the `Amount` parameter of @c FunctionPtrs::Encrypt.
+  enum : uint32_t {
+    /// @brief Re-encrypt all eligible decrypted pages at once.
+    THEIA_ENCRYPT_ALL = 0xFFFFFFFF,
+
+    /// @brief Flag indicating that the remaining bits of `Amount` are a time budget in microseconds, rather
+    ///        than a count of pages.
+    ///
+    /// @note Available since interface version 7.
+    THEIA_ENCRYPT_MICROSECONDS = 0x80000000,
+  };
+
+  /// @brief Build an `Amount` for @c FunctionPtrs::Encrypt that re-encrypts at most `Count` pages.
+  ///
+  /// @note Available since interface version 7.
+  constexpr uint32_t EncryptPages(uint32_t Count) noexcept {
+    return Count < THEIA_ENCRYPT_MICROSECONDS ? Count : THEIA_ENCRYPT_MICROSECONDS - 1;
+  }
+
+  /// @brief Build an `Amount` for @c FunctionPtrs::Encrypt that re-encrypts pages for at most `Microseconds`.
+  ///
+  /// @note Available since interface version 7.
+  constexpr uint32_t EncryptMicroseconds(uint32_t Microseconds) noexcept {
+    // the largest budget is one microsecond short, as all bits set mean THEIA_ENCRYPT_ALL
+    return THEIA_ENCRYPT_MICROSECONDS | (Microseconds < THEIA_ENCRYPT_MICROSECONDS - 1 ? Microseconds : THEIA_ENCRYPT_MICROSECONDS - 2);
+  }
+
+  /// @brief Function type signature for completion callbacks of @c FunctionPtrs::EncryptAsync.
+  ///
+  /// @param Context The context pointer passed to @c FunctionPtrs::EncryptAsync.
+  using EncryptCallbackType = void(void* Context);
+
+  /// @brief Flags describing the state of a page in @c PageStatsEntry.
+  enum : uint32_t {
+    /// @brief The page is currently decrypted.
+    THEIA_PAGE_DECRYPTED = 0x1,
+
+    /// @brief The page is excluded from periodic re-encryption, see @c FunctionPtrs::PinPages.
+    THEIA_PAGE_PINNED = 0x2,
+  };
+
+  /// @brief Decisions of adaptive periodic re-encryption, reported in @c PageStats::ReencryptionDecision.
+  enum : uint32_t {
+    /// @brief Periodic re-encryption is disabled, or uses the fixed `count` and `interval` of the runtime
+    ///        configuration.
+    THEIA_REENCRYPTION_FIXED = 0,
+
+    /// @brief The observed fault rate and overhead were within their targets, so the settings were kept.
+    THEIA_REENCRYPTION_HELD = 1,
+
+    /// @brief The observed fault rate and overhead were well below their targets, so more pages are
+    ///        re-encrypted.
+    THEIA_REENCRYPTION_INCREASED = 2,
+
+    /// @brief The observed fault rate or overhead exceeded its target, so fewer pages are re-encrypted.
+    THEIA_REENCRYPTION_DECREASED = 3,
+  };
+
+  /// @brief Statistics on a single page of the current module that is eligible for re-encryption.
+  ///
+  /// @note Available since interface version 11.
+  struct PageStatsEntry {
+    /// @brief RVA of the page within the module.
+    uint32_t Rva;
+
+    /// @brief Combination of @c THEIA_PAGE_DECRYPTED and @c THEIA_PAGE_PINNED.
+    uint32_t Flags;
+
+    /// @brief Count of times the page was decrypted because it was accessed.
+    uint32_t DecryptCount;
+
+    /// @brief Count of times the page was re-encrypted, periodically or on request.
+    uint32_t ReencryptCount;
+
+    /// @brief Time of the last decryption in milliseconds since the module was loaded, or 0 if the page
+    ///        was never decrypted.
+    uint64_t LastDecryptMilliseconds;
+  };
+
   /// @brief Statistics on the protected pages in the current module.
   struct PageStats {
     /// @brief Size of this structure.
@@ -841,6 +948,167 @@ namespace THEIA_REAL_NAMESPACE {
 
     /// @brief Count of eligible pages in the module for re-encryption that are currently decrypted.
     uint32_t CountPagesEncryptableDecrypted{};
+
+    /// @brief Count of eligible pages in the module for re-encryption that are excluded from periodic
+    ///        re-encryption, through @c FunctionPtrs::PinPages or the module configuration.
+    ///
+    /// @note Available since interface version 10.
+    uint32_t CountPagesPinned{};
+
+    /// @brief Array receiving statistics on each page eligible for re-encryption, ordered by RVA, or
+    ///        @c nullptr to only query the counts above.
+    ///
+    /// @note Available since interface version 11.
+    PageStatsEntry* Pages{};
+
+    /// @brief Count of entries that fit into `Pages`.
+    ///
+    /// @note Available since interface version 11.
+    uint32_t PagesCapacity{};
+
+    /// @brief Count of pages eligible for re-encryption, set by the query. If this exceeds `PagesCapacity`,
+    ///        only the first `PagesCapacity` entries were written.
+    ///
+    /// @note Available since interface version 11.
+    uint32_t PagesCount{};
+
+    /// @brief Count of pages currently re-encrypted per tick of periodic re-encryption, or 0 if it is disabled.
+    ///
+    /// With the `adaptive` option of `periodic_reencryption` in the runtime configuration, this and
+    /// `ReencryptionInterval` are tuned online, and may differ from the configured `count` and `interval`.
+    ///
+    /// @note Available since interface version 14.
+    uint32_t ReencryptionCount{};
+
+    /// @brief Current interval between ticks of periodic re-encryption in milliseconds, or 0 if it is disabled.
+    ///
+    /// @note Available since interface version 14.
+    uint32_t ReencryptionInterval{};
+
+    /// @brief Last decision of adaptive periodic re-encryption, one of the `THEIA_REENCRYPTION_` values.
+    ///
+    /// @note Available since interface version 14.
+    uint32_t ReencryptionDecision{};
+
+    /// @brief Decrypt faults per second observed during the last adjustment period of adaptive periodic
+    ///        re-encryption, or 0 if it is not enabled.
+    ///
+    /// @note Available since interface version 14.
+    uint32_t DecryptFaultRate{};
+
+    /// @brief Time in microseconds per second spent on decrypt faults and periodic re-encryption during the
+    ///        last adjustment period of adaptive periodic re-encryption, or 0 if it is not enabled.
+    ///
+    /// @note Available since interface version 14.
+    uint32_t OverheadMicrosecondsPerSecond{};
+  };
+
+  /// @brief Count of buckets in a @c LatencyHistogram.
+  enum : uint32_t {
+    THEIA_LATENCY_BUCKETS = 32,
+  };
+
+  /// @brief Distribution of the time spent on a single kind of runtime event.
+  ///
+  /// Buckets are logarithmic: bucket `i` counts events that took at least 2^i and less than 2^(i+1)
+  /// nanoseconds. Bucket 0 also counts events that took less than a nanosecond, and the last bucket also
+  /// counts all events that took longer than its upper bound.
+  ///
+  /// @note Available since interface version 12.
+  struct LatencyHistogram {
+    /// @brief Count of events.
+    uint64_t Count;
+
+    /// @brief Total time spent on all events, in nanoseconds.
+    uint64_t TotalNanoseconds;
+
+    /// @brief Time spent on the longest event, in nanoseconds.
+    uint64_t MaxNanoseconds;
+
+    /// @brief Count of events per duration bucket.
+    uint64_t Buckets[THEIA_LATENCY_BUCKETS];
+  };
+
+  /// @brief Time spent by the Theia runtime on events that interrupt the application.
+  ///
+  /// @note Available since interface version 12.
+  struct LatencyStats {
+    /// @brief Size of this structure.
+    uint32_t BufferSize = sizeof(LatencyStats);
+
+    /// @brief Time covered by the histograms, i.e. since the last reset or the start of the process, in
+    ///        nanoseconds.
+    uint64_t IntervalNanoseconds{};
+
+    /// @brief Handling of faults on encrypted pages, including their decryption.
+    LatencyHistogram DecryptFaults{};
+
+    /// @brief Dispatch of nanomites.
+    LatencyHistogram NanomiteDispatches{};
+
+    /// @brief Periodic tasks of the runtime, such as periodic re-encryption and nanomite removal, including
+    ///        those running on threads of the runtime.
+    LatencyHistogram PeriodicTasks{};
+  };
+
+  /// @brief Estimate the duration below which the given fraction of events in `Histogram` completed.
+  ///
+  /// @param Histogram Histogram to evaluate.
+  /// @param Fraction Fraction of events between 0 and 1, e.g. 0.99 for the 99th percentile.
+  /// @return Upper bound of the bucket containing the percentile, in nanoseconds, limited to the duration of
+  ///         the longest event. 0 if the histogram is empty.
+  inline uint64_t EstimatePercentile(const LatencyHistogram& Histogram, double Fraction) {
+    if (Histogram.Count == 0)
+      return 0;
+
+    const double Target = Fraction * static_cast<double>(Histogram.Count);
+    uint64_t Seen = 0;
+    for (uint32_t i = 0; i < THEIA_LATENCY_BUCKETS; ++i) {
+      Seen += Histogram.Buckets[i];
+      if (static_cast<double>(Seen) >= Target) {
+        const uint64_t UpperBound = (uint64_t(2) << i) - 1;
+        return UpperBound < Histogram.MaxNanoseconds ? UpperBound : Histogram.MaxNanoseconds;
+      }
+    }
+    return Histogram.MaxNanoseconds;
+  }
+
+  /// @brief Statistics on the memory usage and critical sections of a protected heap.
+  struct HeapStats {
+    /// @brief Size of this structure.
+    uint32_t BufferSize = sizeof(HeapStats);
+
+    /// @brief Count of bytes currently used by allocations, including per-allocation overhead.
+    uint64_t BytesInUse{};
+
+    /// @brief Highest value of @c BytesInUse since the heap was created.
+    uint64_t PeakBytesInUse{};
+
+    /// @brief Count of bytes of the reservation that are backed by memory.
+    uint64_t BytesCommitted{};
+
+    /// @brief Count of bytes reserved for the heap, i.e. the `ReservedSize` of the heap rounded up.
+    uint64_t BytesReserved{};
+
+    /// @brief Size of the largest contiguous range of free memory, in bytes.
+    ///
+    /// Comparing this to `BytesReserved - BytesInUse` indicates how fragmented the heap is.
+    uint64_t LargestFreeBlock{};
+
+    /// @brief Count of allocations that are currently live.
+    uint64_t AllocationCount{};
+
+    /// @brief Count of calls to @c Heap::lock.
+    uint64_t LockCount{};
+
+    /// @brief Count of calls to @c Heap::unlock.
+    uint64_t UnlockCount{};
+
+    /// @brief Total time spent in @c Heap::lock, in nanoseconds.
+    uint64_t LockNanoseconds{};
+
+    /// @brief Total time spent in @c Heap::unlock, in nanoseconds.
+    uint64_t UnlockNanoseconds{};
   };
 
   /// @brief A Theia protected heap instance.
@@ -884,7 +1152,12 @@ namespace THEIA_REAL_NAMESPACE {
     /// be a null pointer, but is always legal to pass to `DeAllocate` and `ReAllocate`.
     ///
     /// The returned value has an alignment of double pointer size, i.e. 16 bytes. If you require
-    /// a bigger alignment, you must manually align the pointer yourself.
+    /// a bigger alignment, use @c AllocateAligned instead.
+    ///
+    /// Protected heaps of the runtime are meant for small to medium-sized objects, and very large
+    /// allocations (roughly above 1MB) may fail. The StandInHeap of `theia_standin_heap.hpp` instead serves
+    /// allocations of at least 1MB from dedicated regions aligned to 64kB, which are only limited by
+    /// `MaxAllocSize` and the remaining `ReservedSize`.
     ///
     /// @note Calling this function outside of a critical section is undefined behavior.
     /// @param Size Amount of bytes required for newly allocated storage.
@@ -997,8 +1270,236 @@ namespace THEIA_REAL_NAMESPACE {
     /// @note Calling this function outside of a critical section is undefined behavior.
     /// @return Allocation size of `Pointer` if successful, @c -1 otherwise.
     virtual size_t GetSize(void* Pointer) = 0;
+
+    /// @brief Allocate a memory region of the given size and alignment.
+    ///
+    /// Behaves like @c Allocate, except that the returned pointer is aligned to at least `Alignment` bytes.
+    /// Memory allocated by this function must be released with @c DeAllocateAligned, and its size can be
+    /// retrieved with @c GetAlignedSize. Passing it to @c DeAllocate, @c ReAllocate or @c GetSize is
+    /// undefined behavior.
+    ///
+    /// The default implementation pads a regular allocation from @c Allocate. Heaps of runtimes predating
+    /// interface version 3 do not implement this function at all, so call @c HeapAllocateAligned instead.
+    ///
+    /// @note Available since interface version 3.
+    /// @note Calling this function outside of a critical section is undefined behavior.
+    /// @param Size Amount of bytes required for newly allocated storage.
+    /// @param Alignment Required alignment of the storage. Must be a power of two.
+    /// @return pointer of newly allocated space or @c nullptr if allocation failed or `Alignment` is invalid.
+    virtual void* AllocateAligned(size_t Size, size_t Alignment);
+
+    /// @brief Deallocate an object previously allocated with @c AllocateAligned.
+    ///
+    /// Calling this function with a pointer not allocated by @c AllocateAligned of this heap, or a pointer
+    /// that has already been deallocated, is undefined behavior. Use @c HeapDeAllocateAligned for memory
+    /// allocated with @c HeapAllocateAligned.
+    ///
+    /// @note Available since interface version 3.
+    /// @note Calling this function outside of a critical section is undefined behavior.
+    /// @param Pointer Pointer to deallocate.
+    /// @return @c true if deallocation succeeded, @c false otherwise.
+    virtual bool DeAllocateAligned(void* Pointer);
+
+    /// @brief Retrieve the size of an allocation made with @c AllocateAligned.
+    ///
+    /// Unlike @c GetSize on a manually aligned pointer, the result does not include any padding needed to
+    /// align the allocation. If `Pointer` was not allocated by @c AllocateAligned of this heap, or if it has
+    /// already been deallocated, the behavior is undefined. Use @c HeapGetAlignedSize for memory allocated
+    /// with @c HeapAllocateAligned.
+    ///
+    /// @note Available since interface version 3.
+    /// @note Calling this function outside of a critical section is undefined behavior.
+    /// @return Usable size of `Pointer` if successful, @c -1 otherwise.
+    virtual size_t GetAlignedSize(void* Pointer);
+
+    /// @brief Allocate `Count` memory regions of the same size in a single call.
+    ///
+    /// The allocation either succeeds as a whole, or fails without allocating anything. On success,
+    /// `Pointers[0]` to `Pointers[Count - 1]` receive the allocated regions, which must be released
+    /// individually with @c DeAllocate or together with @c DeAllocateBatch. On failure, all entries of
+    /// `Pointers` are set to @c nullptr.
+    ///
+    /// The default implementation calls @c Allocate in a loop. Heaps of runtimes predating interface version 4
+    /// do not implement this function at all, so call @c HeapAllocateBatch instead.
+    ///
+    /// @note Available since interface version 4.
+    /// @note Calling this function outside of a critical section is undefined behavior.
+    /// @param Size Amount of bytes required for each allocation.
+    /// @param Count Amount of allocations to perform.
+    /// @param Pointers Array of at least `Count` elements receiving the allocated pointers.
+    /// @return @c true if all allocations succeeded, @c false otherwise.
+    virtual bool AllocateBatch(size_t Size, size_t Count, void** Pointers);
+
+    /// @brief Deallocate `Count` previously allocated objects in a single call.
+    ///
+    /// Behaves as if @c DeAllocate was called for every element of `Pointers`, in order. Null pointers
+    /// are ignored. The pointers do not need to originate from the same call to @c AllocateBatch.
+    ///
+    /// The default implementation calls @c DeAllocate in a loop. Heaps of runtimes predating interface
+    /// version 4 do not implement this function at all, so call @c HeapDeAllocateBatch instead.
+    ///
+    /// @note Available since interface version 4.
+    /// @note Calling this function outside of a critical section is undefined behavior.
+    /// @param Pointers Array of `Count` pointers to deallocate.
+    /// @param Count Amount of elements in `Pointers`.
+    /// @return @c true if all deallocations succeeded, @c false otherwise.
+    virtual bool DeAllocateBatch(void* const* Pointers, size_t Count);
+
+    /// @brief Retrieve statistics on the memory usage and critical sections of this heap.
+    ///
+    /// The buffer size field must be initialized properly with correct size of structure. This ensures that any
+    /// additions to @c HeapStats continue working with binaries built against older SDKs.
+    ///
+    /// Heaps without statistics, such as the dummy heap returned in unprotected processes, fail this call.
+    /// Heaps of runtimes predating interface version 5 do not implement this function at all, so call
+    /// @c HeapQueryStats instead.
+    ///
+    /// @note Available since interface version 5.
+    /// @note Calling this function outside of a critical section is undefined behavior. The counters of the
+    ///       current call to @c lock are included in the result.
+    /// @param OutputBuffer Pointer to output buffer.
+    /// @return 0 if successful.
+    virtual size_t QueryStats(HeapStats* OutputBuffer) {
+      (void)OutputBuffer;
+      return (size_t)-1;
+    }
+
+    /// @brief Copy the contents of this heap into `Buffer`, so that they can be restored later.
+    ///
+    /// A full snapshot contains all pages in use by the heap, along with the state of its allocator. An
+    /// incremental snapshot only contains the pages modified since the previous snapshot of this heap,
+    /// which is typically much smaller. Taking a snapshot of either kind starts a new increment.
+    ///
+    /// If `BufferSize` is smaller than the snapshot, nothing is written and the required size is returned.
+    /// Passing @c nullptr and 0 queries the size of the snapshot without taking it.
+    ///
+    /// Copying the heap is not treated as an access to its memory, and does not affect the detection of
+    /// accesses from outside of the critical section.
+    ///
+    /// Heaps of runtimes predating interface version 6 do not implement this function at all, so call
+    /// @c HeapSnapshot instead.
+    ///
+    /// @note Available since interface version 6.
+    /// @note Calling this function outside of a critical section is undefined behavior.
+    /// @param Buffer Buffer to write the snapshot to.
+    /// @param BufferSize Size of `Buffer` in bytes.
+    /// @param Incremental Whether to only include pages modified since the previous snapshot.
+    /// @return Size of the snapshot in bytes, or @c -1 if this heap does not support snapshots.
+    virtual size_t Snapshot(void* Buffer, size_t BufferSize, bool Incremental) {
+      (void)Buffer;
+      (void)BufferSize;
+      (void)Incremental;
+      return (size_t)-1;
+    }
+
+    /// @brief Restore the contents of this heap from a snapshot taken by @c Snapshot.
+    ///
+    /// Restoring a full snapshot returns the heap to the state it had when the snapshot was taken. An
+    /// incremental snapshot is restored by first restoring the full snapshot it builds on, followed by all
+    /// incremental snapshots taken in between, in the order they were taken.
+    ///
+    /// All pointers to allocations made after the snapshot was taken are invalidated. Restoring fails if the
+    /// snapshot was taken from a different heap, or if allocations served from separate regions were made,
+    /// resized, or freed since.
+    ///
+    /// Heaps of runtimes predating interface version 6 do not implement this function at all, so call
+    /// @c HeapRestore instead.
+    ///
+    /// @note Available since interface version 6.
+    /// @note Calling this function outside of a critical section is undefined behavior.
+    /// @param Buffer Snapshot to restore.
+    /// @param BufferSize Size of the snapshot in bytes, as returned by @c Snapshot.
+    /// @return @c true if successful, @c false if the snapshot could not be restored and the heap is unchanged.
+    virtual bool Restore(const void* Buffer, size_t BufferSize) {
+      (void)Buffer;
+      (void)BufferSize;
+      return false;
+    }
   };
 
+  namespace detail {
+    // Header in front of over-aligned allocations served by padding a regular allocation.
+    struct PaddedAllocationHeader {
+      void* Raw;
+      size_t Size;
+    };
+
+    // Serve an aligned allocation by padding a regular allocation of `Target`. Used by the SDK-side heaps.
+    inline void* PaddedAllocateAligned(Heap& Target, size_t Size, size_t Alignment) {
+      if (Alignment == 0 || (Alignment & (Alignment - 1)) != 0)
+        return nullptr;
+      if (Alignment < sizeof(PaddedAllocationHeader))
+        Alignment = sizeof(PaddedAllocationHeader);
+
+      const size_t Padding = Alignment + sizeof(PaddedAllocationHeader);
+      if (Size > static_cast<size_t>(-1) - Padding)
+        return nullptr;
+
+      void* Raw = Target.Allocate(Size + Padding);
+      if (Raw == nullptr)
+        return nullptr;
+
+      const uintptr_t Aligned = (reinterpret_cast<uintptr_t>(Raw) + sizeof(PaddedAllocationHeader) + Alignment - 1) & ~(static_cast<uintptr_t>(Alignment) - 1);
+      PaddedAllocationHeader* Header = reinterpret_cast<PaddedAllocationHeader*>(Aligned) - 1;
+      Header->Raw = Raw;
+      Header->Size = Size;
+      return reinterpret_cast<void*>(Aligned);
+    }
+
+    inline bool PaddedDeAllocateAligned(Heap& Target, void* Pointer) {
+      return Pointer == nullptr || Target.DeAllocate((static_cast<PaddedAllocationHeader*>(Pointer) - 1)->Raw);
+    }
+
+    inline size_t PaddedGetAlignedSize(void* Pointer) {
+      return Pointer != nullptr ? (static_cast<PaddedAllocationHeader*>(Pointer) - 1)->Size : 0;
+    }
+
+    // Serve a batch of allocations by calling Heap::Allocate in a loop.
+    inline bool LoopAllocateBatch(Heap& Target, size_t Size, size_t Count, void** Pointers) {
+      for (size_t i = 0; i < Count; ++i) {
+        Pointers[i] = Target.Allocate(Size);
+        if (Pointers[i] == nullptr) {
+          for (size_t j = 0; j < i; ++j)
+            Target.DeAllocate(Pointers[j]);
+          for (size_t j = 0; j < Count; ++j)
+            Pointers[j] = nullptr;
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Release a batch of allocations by calling Heap::DeAllocate in a loop.
+    inline bool LoopDeAllocateBatch(Heap& Target, void* const* Pointers, size_t Count) {
+      bool Result = true;
+      for (size_t i = 0; i < Count; ++i) {
+        if (Pointers[i] != nullptr && !Target.DeAllocate(Pointers[i]))
+          Result = false;
+      }
+      return Result;
+    }
+  } // namespace detail
+
+  inline void* Heap::AllocateAligned(size_t Size, size_t Alignment) {
+    return detail::PaddedAllocateAligned(*this, Size, Alignment);
+  }
+
+  inline bool Heap::DeAllocateAligned(void* Pointer) {
+    return detail::PaddedDeAllocateAligned(*this, Pointer);
+  }
+
+  inline size_t Heap::GetAlignedSize(void* Pointer) {
+    return detail::PaddedGetAlignedSize(Pointer);
+  }
+
+  inline bool Heap::AllocateBatch(size_t Size, size_t Count, void** Pointers) {
+    return detail::LoopAllocateBatch(*this, Size, Count, Pointers);
+  }
+
+  inline bool Heap::DeAllocateBatch(void* const* Pointers, size_t Count) {
+    return detail::LoopDeAllocateBatch(*this, Pointers, Count);
+  }
+
   /// @brief Interface to the Theia runtime exposed to your protected binary.
   ///
   /// You can use this interface to communicate with the Theia runtime. To obtain an interface
@@ -1040,14 +1541,26 @@ namespace THEIA_REAL_NAMESPACE {
     /// @brief Instruct the Theia runtime to re-encrypt parts of the executable.
     ///
     /// When invoked, re-encrypts parts of the executable. How much is re-encrypted depends on the parameter
-    /// `Amount`.
+    /// `Amount`:
+    ///
+    /// - @c THEIA_ENCRYPT_ALL re-encrypts all eligible decrypted pages of the binary.
+    /// - A value built by @c EncryptPages re-encrypts at most the given count of pages.
+    /// - A value built by @c EncryptMicroseconds re-encrypts pages until the given time has elapsed. The
+    ///   budget is checked after each page, so the call may exceed it by the time needed for one page.
     ///
-    /// Currently, only a value of MAX_UINT (0xFFFFFFFF) is supported. This represents a full re-encryption of the
-    /// binary, resulting in all eligible decrypted pages being re-encrypted.
+    /// Budgeted calls resume where the previous budgeted call stopped, and wrap around at the end of the
+    /// binary, so that repeated calls with a small budget eventually visit every eligible page. This allows
+    /// spreading re-encryption across frames with a predictable cost per frame. Pages that are already
+    /// encrypted are skipped and do not count towards a page budget. Use @c QueryPageStats to find out how many
+    /// eligible pages remain decrypted.
+    ///
+    /// Runtimes predating interface version 7 only support @c THEIA_ENCRYPT_ALL. In unprotected processes, no
+    /// pages are encrypted, so this function returns immediately regardless of the budget.
     ///
     /// This function is thread-safe and can be called from multiple threads at the same time without issues.
+    /// Concurrent budgeted calls share their position and each consume their own budget.
     ///
-    /// @param Amount Must be 0xFFFFFFFF.
+    /// @param Amount @c THEIA_ENCRYPT_ALL, or a budget built by @c EncryptPages or @c EncryptMicroseconds.
     void (*Encrypt)(uint32_t Amount);
 
     /// @brief Retrieve statistics on protected pages for the current module.
@@ -1055,6 +1568,10 @@ namespace THEIA_REAL_NAMESPACE {
     /// The buffer size field must be initialized properly with correct size of structure. This ensures that any
     /// additions to @c PageStats continue working with binaries built against older SDKs.
     ///
+    /// Since interface version 11, per-page statistics are written to `Pages` if it is set. Allocate an array of
+    /// at least `CountPagesEncryptableTotal` entries to receive all of them at once. Since interface version 14,
+    /// the current settings and last decision of adaptive periodic re-encryption are reported as well.
+    ///
     /// @param OutputBuffer Pointer to output buffer.
     /// @return 0 if successful.
     size_t (*QueryPageStats)(PageStats* OutputBuffer);
@@ -1063,7 +1580,8 @@ namespace THEIA_REAL_NAMESPACE {
     ///
     /// If the current module is unprotected (i.e. not packed), a per-module global instance is returned which
     /// serves allocations directly from the CRT allocator, and both `ReservedSize` and `MaxAllocSize` are not
-    /// enforced.
+    /// enforced. On Linux, defining `THEIA_STANDIN_HEAP` replaces this instance with a StandInHeap from
+    /// `theia_standin_heap.hpp` instead.
     ///
     /// @note Attempting to allocate more than `MaxAllocSize` bytes in a single call to `Allocate` is undefined
     ///       behavior and may or may not yield a valid pointer.
@@ -1081,6 +1599,128 @@ namespace THEIA_REAL_NAMESPACE {
     /// @param Reserved Must be nullptr.
     /// @return Pointer to an instance of protected heap.
     Heap* (*CreateHeap)(size_t ReservedSize, size_t MaxAllocSize, void* Reserved);
+
+    /// @brief Instruct the Theia runtime to re-encrypt parts of the executable in the background.
+    ///
+    /// Behaves like @c Encrypt, but returns immediately and performs the re-encryption on a low-priority worker
+    /// thread owned by the runtime. This allows re-encrypting the entire binary, e.g. on level transitions,
+    /// without blocking the calling thread. Requests are processed in the order they were made, and a budget
+    /// in microseconds applies to the time spent on the worker thread.
+    ///
+    /// Once the request is processed, `Callback` is invoked with `Context`. The callback may run on any thread,
+    /// including the calling thread before this function returns, and must not block for long. Callbacks of
+    /// subsequent requests are not invoked until it returns.
+    ///
+    /// In unprotected processes, no pages are encrypted, so the callback is invoked immediately.
+    ///
+    /// This function is thread-safe and can be called from multiple threads at the same time without issues.
+    ///
+    /// @note Available since interface version 8.
+    /// @param Amount @c THEIA_ENCRYPT_ALL, or a budget built by @c EncryptPages or @c EncryptMicroseconds.
+    /// @param Callback Function to invoke once the request is processed, or @c nullptr.
+    /// @param Context Pointer passed to `Callback`.
+    /// @return @c true if the request was scheduled, @c false if it was rejected, in which case `Callback` is
+    ///         never invoked.
+    bool (*EncryptAsync)(uint32_t Amount, EncryptCallbackType* Callback, void* Context);
+
+    /// @brief Decrypt the pages of the current module in [`Begin`, `End`) ahead of their first use.
+    ///
+    /// Continuously encrypted pages are decrypted when they are first executed or read, which causes a burst
+    /// of decryptions when a lot of code runs for the first time, e.g. in the first frame of a new level.
+    /// Prefetching the pages of such code while a loading screen is shown moves this cost out of the frame.
+    ///
+    /// Pages that are not continuously encrypted, that are already decrypted, or that are guard pages are
+    /// skipped. Prefetched pages are subject to re-encryption like any other decrypted page, so prefetching
+    /// should happen shortly before the code is needed.
+    ///
+    /// This function is thread-safe and can be called from multiple threads at the same time without issues.
+    ///
+    /// @note Available since interface version 9.
+    /// @param Begin Start of the range to decrypt.
+    /// @param End End of the range to decrypt, exclusive.
+    /// @return Count of pages decrypted by this call.
+    size_t (*PrefetchPages)(const void* Begin, const void* End);
+
+    /// @brief Exclude the pages of the current module in [`Begin`, `End`) from periodic re-encryption.
+    ///
+    /// Pages of latency-critical code, such as render or netcode loops, fault back in shortly after periodic
+    /// re-encryption, which causes periodic frame spikes. Pinned pages stay encrypted until they are first used
+    /// like any other page, but are then skipped by periodic re-encryption and by budgeted calls to @c Encrypt.
+    /// Calls to @c Encrypt with @c THEIA_ENCRYPT_ALL, and full re-encryptions due to the
+    /// `full_reencryption_threshold` module option, still re-encrypt pinned pages.
+    ///
+    /// Pins are counted per page: a page remains pinned until @c UnpinPages was called for it as often as
+    /// @c PinPages. Pages that are not eligible for re-encryption are ignored. Pages can also be pinned using
+    /// the `pinned_pages` module option.
+    ///
+    /// This function is thread-safe and can be called from multiple threads at the same time without issues.
+    ///
+    /// @note Available since interface version 10.
+    /// @param Begin Start of the range to pin.
+    /// @param End End of the range to pin, exclusive.
+    /// @return Count of pages eligible for re-encryption within the range.
+    size_t (*PinPages)(const void* Begin, const void* End);
+
+    /// @brief Revert a previous call to @c PinPages with the same range.
+    ///
+    /// Pages that become unpinned are subject to periodic re-encryption again. Pages pinned by the module
+    /// configuration can not be unpinned.
+    ///
+    /// @note Available since interface version 10.
+    /// @param Begin Start of the range to unpin.
+    /// @param End End of the range to unpin, exclusive.
+    /// @return Count of pages eligible for re-encryption within the range.
+    size_t (*UnpinPages)(const void* Begin, const void* End);
+
+    /// @brief Retrieve histograms of the time spent by the Theia runtime on fault handling, nanomite dispatch and
+    ///        periodic tasks.
+    ///
+    /// The histograms cover all threads of the process, and accumulate since the previous call that reset them,
+    /// or since the start of the process. This allows attributing frame time to protection overhead, e.g. by
+    /// querying and resetting the histograms once per telemetry interval.
+    ///
+    /// The buffer size field must be initialized properly with correct size of structure. This ensures that any
+    /// additions to @c LatencyStats continue working with binaries built against older SDKs.
+    ///
+    /// In unprotected processes, all histograms are empty.
+    ///
+    /// This function is thread-safe and can be called from multiple threads at the same time without issues.
+    ///
+    /// @note Available since interface version 12.
+    /// @param OutputBuffer Pointer to output buffer.
+    /// @param Reset Whether to reset the histograms after reading them.
+    /// @return 0 if successful.
+    size_t (*QueryLatencyStats)(LatencyStats* OutputBuffer, bool Reset);
+
+    /// @brief Mark the beginning of a frame.
+    ///
+    /// Periodic tasks, such as periodic integrity checks and re-encryption, normally run on wall-clock timers,
+    /// and thus often interrupt frames. Once the runtime receives frame hints, it defers periodic tasks that
+    /// become due between @c FrameBegin and @c FrameEnd, and runs them in the idle time reported by
+    /// @c FrameEnd instead. Tasks are deferred at most by the `max_deferral` option of `frame_scheduling` in the
+    /// runtime configuration. If no hints arrive for longer than its `fallback_timeout`, e.g. during loading
+    /// screens, periodic tasks fall back to their timers until hints resume.
+    ///
+    /// Calls must be made from a single thread, usually the thread presenting frames, and must alternate with
+    /// calls to @c FrameEnd.
+    ///
+    /// In unprotected processes, this function does nothing.
+    ///
+    /// @note Available since interface version 13.
+    void (*FrameBegin)();
+
+    /// @brief Mark the end of a frame, and report the idle time until the next frame begins.
+    ///
+    /// Due periodic tasks are run right away, as long as they fit into the remaining idle time. Report the time
+    /// until the next call to @c FrameBegin as accurately as possible, e.g. the time until the next vertical
+    /// blank minus the expected time to present the frame. Periodic tasks that do not fit are deferred to
+    /// the idle time of a later frame.
+    ///
+    /// In unprotected processes, this function does nothing.
+    ///
+    /// @note Available since interface version 13.
+    /// @param IdleBudgetMicroseconds Time in microseconds until the next frame begins, or 0 if there is none.
+    void (*FrameEnd)(uint32_t IdleBudgetMicroseconds);
   };
 
   /// @brief Get the Theia interface.
@@ -1088,6 +1728,152 @@ namespace THEIA_REAL_NAMESPACE {
   inline const FunctionPtrs* GetInterface() {
     return detail::g_TheiaVMT;
   }
+
+  /// @brief Get the interface version implemented by the Theia runtime.
+  ///
+  /// Functions added in a later interface version than the one implemented by the runtime must not be
+  /// called. Runtimes predating interface version 2 do not report their version, in which case 1 is
+  /// returned. If Theia is not applied, the placeholders implement @c THEIA_INTERFACE_VERSION.
+  ///
+  /// @return Interface version of the runtime.
+  inline uint32_t GetRuntimeInterfaceVersion() {
+    if (detail::g_TheiaVMT == detail::g_TheiaDefaultVMT)
+      return THEIA_INTERFACE_VERSION;
+    return detail::g_TheiaRuntimeVersion != 0 ? detail::g_TheiaRuntimeVersion : 1;
+  }
+
+  /// @brief Allocate over-aligned memory from `TargetHeap`, regardless of the version of the runtime.
+  ///
+  /// Calls Heap::AllocateAligned if the runtime implements it, and pads a regular allocation otherwise.
+  /// Memory allocated by this function must be released with @c HeapDeAllocateAligned.
+  ///
+  /// @note Calling this function outside of a critical section is undefined behavior.
+  inline void* HeapAllocateAligned(Heap* TargetHeap, size_t Size, size_t Alignment) {
+    if (GetRuntimeInterfaceVersion() < 3)
+      return detail::PaddedAllocateAligned(*TargetHeap, Size, Alignment);
+    return TargetHeap->AllocateAligned(Size, Alignment);
+  }
+
+  /// @brief Deallocate memory allocated with @c HeapAllocateAligned.
+  ///
+  /// @note Calling this function outside of a critical section is undefined behavior.
+  inline bool HeapDeAllocateAligned(Heap* TargetHeap, void* Pointer) {
+    if (GetRuntimeInterfaceVersion() < 3)
+      return detail::PaddedDeAllocateAligned(*TargetHeap, Pointer);
+    return TargetHeap->DeAllocateAligned(Pointer);
+  }
+
+  /// @brief Retrieve the size of memory allocated with @c HeapAllocateAligned.
+  ///
+  /// @note Calling this function outside of a critical section is undefined behavior.
+  inline size_t HeapGetAlignedSize(Heap* TargetHeap, void* Pointer) {
+    if (GetRuntimeInterfaceVersion() < 3)
+      return detail::PaddedGetAlignedSize(Pointer);
+    return TargetHeap->GetAlignedSize(Pointer);
+  }
+
+  /// @brief Allocate `Count` memory regions of the same size from `TargetHeap`, regardless of the version of
+  ///        the runtime.
+  ///
+  /// Calls Heap::AllocateBatch if the runtime implements it, and calls Heap::Allocate in a loop otherwise.
+  ///
+  /// @note Calling this function outside of a critical section is undefined behavior.
+  inline bool HeapAllocateBatch(Heap* TargetHeap, size_t Size, size_t Count, void** Pointers) {
+    if (GetRuntimeInterfaceVersion() < 4)
+      return detail::LoopAllocateBatch(*TargetHeap, Size, Count, Pointers);
+    return TargetHeap->AllocateBatch(Size, Count, Pointers);
+  }
+
+  /// @brief Deallocate `Count` objects from `TargetHeap`, regardless of the version of the runtime.
+  ///
+  /// Calls Heap::DeAllocateBatch if the runtime implements it, and calls Heap::DeAllocate in a loop otherwise.
+  ///
+  /// @note Calling this function outside of a critical section is undefined behavior.
+  inline bool HeapDeAllocateBatch(Heap* TargetHeap, void* const* Pointers, size_t Count) {
+    if (GetRuntimeInterfaceVersion() < 4)
+      return detail::LoopDeAllocateBatch(*TargetHeap, Pointers, Count);
+    return TargetHeap->DeAllocateBatch(Pointers, Count);
+  }
+
+  /// @brief Retrieve statistics of `TargetHeap`, regardless of the version of the runtime.
+  ///
+  /// Calls Heap::QueryStats if the runtime implements it, and fails otherwise.
+  ///
+  /// @note Calling this function outside of a critical section is undefined behavior.
+  inline size_t HeapQueryStats(Heap* TargetHeap, HeapStats* OutputBuffer) {
+    if (GetRuntimeInterfaceVersion() < 5)
+      return (size_t)-1;
+    return TargetHeap->QueryStats(OutputBuffer);
+  }
+
+  /// @brief Take a snapshot of `TargetHeap`, regardless of the version of the runtime.
+  ///
+  /// Calls Heap::Snapshot if the runtime implements it, and fails otherwise.
+  ///
+  /// @note Calling this function outside of a critical section is undefined behavior.
+  inline size_t HeapSnapshot(Heap* TargetHeap, void* Buffer, size_t BufferSize, bool Incremental) {
+    if (GetRuntimeInterfaceVersion() < 6)
+      return (size_t)-1;
+    return TargetHeap->Snapshot(Buffer, BufferSize, Incremental);
+  }
+
+  /// @brief Restore a snapshot of `TargetHeap`, regardless of the version of the runtime.
+  ///
+  /// Calls Heap::Restore if the runtime implements it, and fails otherwise.
+  ///
+  /// @note Calling this function outside of a critical section is undefined behavior.
+  inline bool HeapRestore(Heap* TargetHeap, const void* Buffer, size_t BufferSize) {
+    if (GetRuntimeInterfaceVersion() < 6)
+      return false;
+    return TargetHeap->Restore(Buffer, BufferSize);
+  }
+
+  /// @brief Retrieve statistics on protected pages for the current module, regardless of the version of the
+  ///        runtime.
+  ///
+  /// Sets `BufferSize` to the size of @c PageStats known to the runtime and calls
+  /// @c FunctionPtrs::QueryPageStats. Fields added in later interface versions are left unchanged, e.g.
+  /// `CountPagesPinned` under runtimes predating interface version 10, and `PagesCount` under runtimes
+  /// predating interface version 11.
+  ///
+  /// @param OutputBuffer Pointer to output buffer.
+  /// @return 0 if successful.
+  inline size_t QueryPageStats(PageStats* OutputBuffer) {
+    const uint32_t Version = GetRuntimeInterfaceVersion();
+    if (Version < 10)
+      OutputBuffer->BufferSize = offsetof(PageStats, CountPagesPinned);
+    else if (Version < 11)
+      OutputBuffer->BufferSize = offsetof(PageStats, Pages);
+    else if (Version < 14)
+      OutputBuffer->BufferSize = offsetof(PageStats, ReencryptionCount);
+    else
+      OutputBuffer->BufferSize = sizeof(PageStats);
+    return GetInterface()->QueryPageStats(OutputBuffer);
+  }
+
+  /// @brief Decrypt the pages containing the entry points of the given functions ahead of their first use.
+  ///
+  /// Only the page containing the first instruction of each function is decrypted. Use
+  /// @c FunctionPtrs::PrefetchPages directly for functions that span multiple pages.
+  ///
+  /// Runtimes predating interface version 9 do not implement @c FunctionPtrs::PrefetchPages, in which case
+  /// nothing is decrypted ahead of time and 0 is returned.
+  ///
+  /// @param Functions Pointers to functions of the current module.
+  /// @return Count of pages decrypted by this call.
+  template <typename... F>
+  size_t PrefetchFunctions(F*... Functions) {
+    static_assert(detail::AllFunctions<F...>::value, "PrefetchFunctions only accepts pointers to functions");
+    if (GetRuntimeInterfaceVersion() < 9)
+      return 0;
+
+    const void* Entries[] = {reinterpret_cast<const void*>(Functions)..., nullptr};
+
+    size_t Result = 0;
+    for (size_t i = 0; i < sizeof...(F); ++i)
+      Result += GetInterface()->PrefetchPages(Entries[i], static_cast<const uint8_t*>(Entries[i]) + 1);
+    return Result;
+  }
 } // namespace THEIA_REAL_NAMESPACE
 
 // Internal default implementations for theia::FunctionPtrs, feel free to ignore.
@@ -1103,7 +1889,7 @@ namespace THEIA_REAL_NAMESPACE {
     template <typename P>
     struct CallMSize<P, decltype(_msize((P) nullptr))> {
       static size_t Call(void* Pointer) {
-        return Pointer != nullptr ? _msize(Pointer) : 0;
+        return Pointer != nullptr ? _msize(static_cast<P>(Pointer)) : 0;
       }
     };
 
@@ -1125,19 +1911,94 @@ namespace THEIA_REAL_NAMESPACE {
     }
 
     static void DefaultEncrypt(uint32_t Amount) {
+      // unprotected modules have no encrypted pages, so every budget is met without doing any work
       (void)Amount;
     }
 
+    static bool DefaultEncryptAsync(uint32_t Amount, EncryptCallbackType* Callback, void* Context) {
+      DefaultEncrypt(Amount);
+      if (Callback != nullptr)
+        Callback(Context);
+      return true;
+    }
+
+    static size_t DefaultPrefetchPages(const void* Begin, const void* End) {
+      // unprotected modules have no encrypted pages to decrypt
+      (void)Begin;
+      (void)End;
+      return 0;
+    }
+
+    static size_t DefaultPinPages(const void* Begin, const void* End) {
+      // unprotected modules have no pages eligible for re-encryption
+      (void)Begin;
+      (void)End;
+      return 0;
+    }
+
+    static void DefaultFrameBegin() {}
+
+    static void DefaultFrameEnd(uint32_t IdleBudgetMicroseconds) {
+      // unprotected processes have no periodic tasks to schedule
+      (void)IdleBudgetMicroseconds;
+    }
+
+    static size_t DefaultQueryLatencyStats(LatencyStats* OutputBuffer, bool Reset) {
+      if (OutputBuffer->BufferSize != sizeof(LatencyStats))
+        return (size_t)-1;
+
+      // the histograms stay empty, but the interval is real, so that shares of it are well-defined
+      const auto Now = []() {
+        return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+      };
+      static std::atomic<int64_t> s_IntervalStart{Now()};
+      const int64_t Current = Now();
+      const int64_t Start = Reset ? s_IntervalStart.exchange(Current, std::memory_order_relaxed) : s_IntervalStart.load(std::memory_order_relaxed);
+
+      *OutputBuffer = {};
+      OutputBuffer->IntervalNanoseconds = Current > Start ? static_cast<uint64_t>(Current - Start) : 1;
+      return 0;
+    }
+
     static size_t DefaultQueryPageStats(PageStats* OutputBuffer) {
-      if (OutputBuffer->BufferSize == sizeof(PageStats)) {
-        *OutputBuffer = {};
-        return 0;
+      // structures of older SDKs end before the fields added since, which must not be written
+      const uint32_t BufferSize = OutputBuffer->BufferSize;
+      if (BufferSize != sizeof(PageStats) && BufferSize != offsetof(PageStats, ReencryptionCount) && BufferSize != offsetof(PageStats, Pages) &&
+          BufferSize != offsetof(PageStats, CountPagesPinned))
+        return (size_t)-1;
+
+      OutputBuffer->CountPagesTotal = 0;
+      OutputBuffer->CountPagesDecrypted = 0;
+      OutputBuffer->CountPagesEncryptableTotal = 0;
+      OutputBuffer->CountPagesEncryptableDecrypted = 0;
+      if (BufferSize > offsetof(PageStats, CountPagesPinned))
+        OutputBuffer->CountPagesPinned = 0;
+      if (BufferSize > offsetof(PageStats, Pages))
+        OutputBuffer->PagesCount = 0;
+      if (BufferSize > offsetof(PageStats, ReencryptionCount)) {
+        OutputBuffer->ReencryptionCount = 0;
+        OutputBuffer->ReencryptionInterval = 0;
+        OutputBuffer->ReencryptionDecision = THEIA_REENCRYPTION_FIXED;
+        OutputBuffer->DecryptFaultRate = 0;
+        OutputBuffer->OverheadMicrosecondsPerSecond = 0;
       }
-      return (size_t)-1;
+      return 0;
     }
 
+#if defined(THEIA_STANDIN_HEAP)
+    // Defined in theia_standin_heap.hpp, which is included at the end of this file.
+    template <typename>
+    Heap* CreateStandInHeap(size_t ReservedSize, size_t MaxAllocSize);
+#endif
+
     template <typename>
-    static Heap* DefaultCreateHeap(size_t /* ReservedSize */, size_t /* MaxAllocSize */, void* /* Reserved */) {
+    static Heap* DefaultCreateHeap(size_t ReservedSize, size_t MaxAllocSize, void* /* Reserved */) {
+#if defined(THEIA_STANDIN_HEAP)
+      return CreateStandInHeap<void>(ReservedSize, MaxAllocSize);
+#else
+      (void)ReservedSize;
+      (void)MaxAllocSize;
+
       class Impl final : public Heap {
       public:
         constexpr Impl() = default;
@@ -1170,10 +2031,17 @@ namespace THEIA_REAL_NAMESPACE {
         size_t GetSize(void* Pointer) override {
           return theia::detail::CallMSize<void*>::Call(Pointer);
         }
+
+        bool DeAllocateBatch(void* const* Pointers, size_t Count) override {
+          for (size_t i = 0; i < Count; ++i)
+            std::free(Pointers[i]);
+          return true;
+        }
       };
 
       static Impl impl;
       return &impl;
+#endif
     }
   } // namespace detail
 } // namespace THEIA_REAL_NAMESPACE
@@ -1190,9 +2058,18 @@ namespace THEIA_REAL_NAMESPACE {
     &theia::detail::DefaultEncrypt,                                                                                                     \
     &theia::detail::DefaultQueryPageStats,                                                                                              \
     &theia::detail::DefaultCreateHeap<void>,                                                                                            \
+    &theia::detail::DefaultEncryptAsync,                                                                                                \
+    &theia::detail::DefaultPrefetchPages,                                                                                               \
+    &theia::detail::DefaultPinPages,                                                                                                    \
+    &theia::detail::DefaultPinPages,                                                                                                    \
+    &theia::detail::DefaultQueryLatencyStats,                                                                                           \
+    &theia::detail::DefaultFrameBegin,                                                                                                  \
+    &theia::detail::DefaultFrameEnd,                                                                                                    \
   };                                                                                                                                    \
   ::theia::Heap::~Heap() = default;                                                                                                     \
   THEIA_EXPORT const theia::FunctionPtrs* theia::detail::g_TheiaVMT = &s_FunctionPtrDefaults;                                           \
+  THEIA_EXPORT uint32_t theia::detail::g_TheiaRuntimeVersion = 0;                                                                       \
+  const theia::FunctionPtrs* const theia::detail::g_TheiaDefaultVMT = &s_FunctionPtrDefaults;                                           \
   template <>                                                                                                                           \
   THEIA_EXPORT void ::theia::detail::TheiaSDKIdentifier<::theia::THEIA_MAJOR_VERSION, ::theia::THEIA_INTERFACE_VERSION>::DoNotCall() {} \
   thread_local theia::detail::ForceDynamicInitializer theia::detail::g_ForceDynamicInitializer;                                         \
@@ -1332,3 +2209,11 @@ namespace THEIA_REAL_NAMESPACE {
   }
   } // namespace detail
 } // namespace THEIA_REAL_NAMESPACE
+
+// records which default heap the SDK was compiled with, see theia_emulator.hpp
+#if defined(THEIA_STANDIN_HEAP)
+#define THEIA_SDK_STANDIN_HEAP 1
+#include "theia_standin_heap.hpp"
+#else
+#define THEIA_SDK_STANDIN_HEAP 0
+#endif
@@ -0,0 +1,1183 @@
+/// @file theia_standin_heap.hpp
+/// @copyright Copyright (C) Zero IT Lab - All Rights Reserved
+/// @brief Stand-in for Theia protected heaps in unprotected processes on Linux.
+///
+/// Unauthorized copying of this file, via any medium is strictly prohibited
+/// Proprietary and confidential
+#pragma once
+
+#if !defined(__linux__)
+#error "The stand-in heap is only available on Linux"
+#endif
+
+#include "theia_sdk.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace THEIA_REAL_NAMESPACE {
+  /// @brief Stand-in for the protected heap in unprotected processes on Linux.
+  ///
+  /// By default, heaps created in an unprotected process are served directly from the CRT allocator, and
+  /// do not enforce `ReservedSize` or `MaxAllocSize`. When `THEIA_STANDIN_HEAP` is defined for the object
+  /// containing @c THEIA_ONCE, @c FunctionPtrs::CreateHeap instead returns a StandInHeap, which behaves
+  /// more like a protected heap:
+  ///
+  /// - `ReservedSize` bytes are reserved up front using @c mmap, and allocations fail once they are used up.
+  /// - Allocations larger than `MaxAllocSize` fail.
+  /// - Allocations of at least 1MB are mapped separately using @c mmap, and resized using @c mremap. Like the
+  ///   reservation, these regions are aligned to 64kB. They count towards `ReservedSize`, and are protected
+  ///   like the rest of the heap.
+  /// - Memory of the heap is inaccessible outside of the critical section. Inside the critical section, pages
+  ///   are made accessible using @c mprotect when they are first touched, and @c unlock only marks those
+  ///   pages as inaccessible again. The cost of @c lock and @c unlock therefore scales with the amount of
+  ///   pages touched inside the critical section, not with the size of the heap. Heaps with up to 1MB of
+  ///   used memory are made accessible as a whole in @c lock instead, which is cheaper at that size.
+  /// - Accesses from outside the critical section are counted, after which the accessed page is made
+  ///   accessible until the next call to @c unlock.
+  /// - The amount and duration of calls to @c lock and @c unlock are recorded.
+  ///
+  /// This allows development and CI builds to observe the memory and performance characteristics of a
+  /// protected heap, and to catch access from outside the critical section, without packing.
+  ///
+  /// @note The stand-in heap installs a @c SIGSEGV handler, which forwards all faults outside of its heaps
+  ///       to the previously installed handler.
+  ///
+  /// @note Pages are only made accessible by touching them from user mode. Passing heap memory that was not
+  ///       yet touched in the current critical section to a system call (e.g. @c read) fails with @c EFAULT.
+  class StandInHeap final : public Heap {
+  public:
+    /// @brief Counters on the usage of a stand-in heap.
+    struct Counters {
+      /// @brief Count of calls to @c lock.
+      uint64_t LockCount;
+
+      /// @brief Count of calls to @c unlock.
+      uint64_t UnlockCount;
+
+      /// @brief Total time spent in @c lock, in nanoseconds.
+      uint64_t LockNanoseconds;
+
+      /// @brief Total time spent in @c unlock, in nanoseconds.
+      uint64_t UnlockNanoseconds;
+
+      /// @brief Count of faults caused by accessing the heap outside of the critical section.
+      uint64_t OutOfSectionFaults;
+
+      /// @brief Count of pages made accessible by touching them inside the critical section.
+      uint64_t InSectionFaults;
+    };
+
+    /// @brief Obtain the stand-in heap behind a heap returned by @c FunctionPtrs::CreateHeap.
+    ///
+    /// @return The stand-in heap, or @c nullptr if `TargetHeap` is not a stand-in heap, e.g. a real protected
+    ///         heap.
+    static StandInHeap* FromHeap(Heap* TargetHeap);
+
+    /// @brief Create a new stand-in heap.
+    ///
+    /// @param ReservedSize Count of bytes to reserve, rounded up to 64kB.
+    /// @param MaxAllocSize Count of bytes for maximum allowed allocation size or @c 0 for any size.
+    /// @return Pointer to the new heap, or @c nullptr if reserving memory failed.
+    static StandInHeap* Create(size_t ReservedSize, size_t MaxAllocSize) {
+      InstallFaultHandler();
+
+      const size_t Reserved = RoundUp(ReservedSize != 0 ? ReservedSize : ReservationGranularity, ReservationGranularity);
+      void* Mapping = MapAligned(Reserved, PROT_NONE);
+      if (Mapping == nullptr)
+        return nullptr;
+
+      const uintptr_t Base = reinterpret_cast<uintptr_t>(Mapping);
+      StandInHeap* Result = new (std::nothrow) StandInHeap(reinterpret_cast<uint8_t*>(Base), Reserved, MaxAllocSize);
+      if (Result == nullptr || Result->m_ModifiedPages == nullptr || Result->m_ReadablePages == nullptr ||
+          Result->Register(Base, Base + Reserved) == nullptr) {
+        delete Result;
+        munmap(reinterpret_cast<void*>(Base), Reserved);
+        return nullptr;
+      }
+      return Result;
+    }
+
+    void Destroy() noexcept override {
+      Unregister();
+      for (const LargeRegion& Region : m_LargeRegions) {
+        if (Region.Begin != 0)
+          munmap(reinterpret_cast<void*>(Region.Begin), Region.Size);
+      }
+      munmap(m_Base, m_Reserved);
+      delete this;
+    }
+
+    void* Allocate(size_t Size) override {
+      if (m_MaxAllocSize != 0 && Size > m_MaxAllocSize)
+        return nullptr;
+
+      void* Result = nullptr;
+      if (Size >= LargeAllocationSize)
+        Result = AllocateLarge(Size);
+      if (Result == nullptr) {
+        Block* NewBlock = AllocateBlock(BlockSizeFor(Size));
+        Result = NewBlock != nullptr ? NewBlock->Payload() : nullptr;
+      }
+      UpdatePeak();
+      return Result;
+    }
+
+    bool DeAllocate(void* Pointer) override {
+      if (IsLarge(Pointer))
+        FreeLarge(Pointer);
+      else if (Pointer != nullptr)
+        FreeBlock(Block::FromPayload(Pointer));
+      return true;
+    }
+
+    void lock() override {
+      const auto Start = std::chrono::steady_clock::now();
+      m_InCriticalSection.store(true, std::memory_order_release);
+
+      // small heaps are cheaper to make accessible at once than page by page on first touch, unless
+      // snapshots need to know which pages are written
+      if (!m_Tracking.load(std::memory_order_relaxed) && m_Committed != 0 && m_Committed <= EagerCommitLimit &&
+          mprotect(m_Base, m_Committed, PROT_READ | PROT_WRITE) == 0) {
+        MarkDirty(reinterpret_cast<uintptr_t>(m_Base), reinterpret_cast<uintptr_t>(m_Base + m_Committed));
+        MarkModified(reinterpret_cast<uintptr_t>(m_Base), reinterpret_cast<uintptr_t>(m_Base + m_Committed));
+      }
+      m_LockCount.fetch_add(1, std::memory_order_relaxed);
+      m_LockNanoseconds.fetch_add(ElapsedSince(Start), std::memory_order_relaxed);
+    }
+
+    void unlock() override {
+      const auto Start = std::chrono::steady_clock::now();
+      ProtectDirtyRanges();
+      m_InCriticalSection.store(false, std::memory_order_release);
+      m_UnlockCount.fetch_add(1, std::memory_order_relaxed);
+      m_UnlockNanoseconds.fetch_add(ElapsedSince(Start), std::memory_order_relaxed);
+    }
+
+    void* GetBackingHeap() override {
+      return nullptr;
+    }
+
+    void* ReAllocate(void* Pointer, size_t Size) override {
+      if (Pointer == nullptr)
+        return Allocate(Size);
+      if (m_MaxAllocSize != 0 && Size > m_MaxAllocSize)
+        return nullptr;
+
+      if (IsLarge(Pointer)) {
+        if (Size >= LargeAllocationSize) {
+          void* Result = ResizeLarge(Pointer, Size);
+          UpdatePeak();
+          return Result;
+        }
+
+        Block* Result = AllocateBlock(BlockSizeFor(Size));
+        if (Result == nullptr)
+          return nullptr;
+        std::memcpy(Result->Payload(), Pointer, Size);
+        FreeLarge(Pointer);
+        return Result->Payload();
+      }
+
+      Block* Current = Block::FromPayload(Pointer);
+      if (Size >= LargeAllocationSize) {
+        void* Result = AllocateLarge(Size);
+        if (Result != nullptr) {
+          std::memcpy(Result, Pointer, Current->Size() - sizeof(Block));
+          FreeBlock(Current);
+          UpdatePeak();
+          return Result;
+        }
+      }
+
+      const size_t Needed = BlockSizeFor(Size);
+      if (Needed <= Current->Size()) {
+        ShrinkBlock(Current, Needed);
+        return Pointer;
+      }
+
+      // grow in place into the unused tail of the reservation, or into a free successor
+      uint8_t* Next = Current->End();
+      if (Next == m_Top) {
+        if (!Commit(Next + (Needed - Current->Size())))
+          return MoveBlock(Current, Size);
+        m_Top = Current->Begin() + Needed;
+        m_TopPrevSize = Needed;
+        Current->SetSize(Needed, true);
+        UpdatePeak();
+        return Pointer;
+      }
+
+      Block* Successor = reinterpret_cast<Block*>(Next);
+      if (!Successor->IsUsed() && Current->Size() + Successor->Size() >= Needed) {
+        Unlink(Successor);
+        Current->SetSize(Current->Size() + Successor->Size(), true);
+        FixSuccessor(Current);
+        ShrinkBlock(Current, Needed);
+        UpdatePeak();
+        return Pointer;
+      }
+
+      return MoveBlock(Current, Size);
+    }
+
+    size_t GetSize(void* Pointer) override {
+      if (IsLarge(Pointer))
+        return m_LargeRegions[LargeHeader::FromPayload(Pointer)->Index].Size - sizeof(LargeHeader);
+      return Pointer != nullptr ? Block::FromPayload(Pointer)->Size() - sizeof(Block) : 0;
+    }
+
+    void* AllocateAligned(size_t Size, size_t Alignment) override {
+      if (m_MaxAllocSize != 0 && Size > m_MaxAllocSize)
+        return nullptr;
+      return Heap::AllocateAligned(Size, Alignment);
+    }
+
+    bool AllocateBatch(size_t Size, size_t Count, void** Pointers) override {
+      if (m_MaxAllocSize != 0 && Size > m_MaxAllocSize) {
+        std::fill(Pointers, Pointers + Count, nullptr);
+        return false;
+      }
+      if (Size >= LargeAllocationSize)
+        return Heap::AllocateBatch(Size, Count, Pointers);
+
+      const size_t BlockSize = BlockSizeFor(Size);
+      for (size_t i = 0; i < Count; ++i) {
+        Block* Result = AllocateBlock(BlockSize);
+        if (Result == nullptr) {
+          DeAllocateBatch(Pointers, i);
+          std::fill(Pointers, Pointers + Count, nullptr);
+          return false;
+        }
+        Pointers[i] = Result->Payload();
+      }
+      UpdatePeak();
+      return true;
+    }
+
+    bool DeAllocateBatch(void* const* Pointers, size_t Count) override {
+      for (size_t i = 0; i < Count; ++i)
+        DeAllocate(Pointers[i]);
+      return true;
+    }
+
+    size_t QueryStats(HeapStats* OutputBuffer) override {
+      if (OutputBuffer->BufferSize != sizeof(HeapStats))
+        return (size_t)-1;
+
+      // walking the highest bin is enough, as all bins below only hold smaller blocks
+      size_t LargestFree = Available();
+      if (m_BinMask != 0) {
+        for (Block* Candidate = m_Bins[BinIndex(static_cast<size_t>(m_BinMask))]; Candidate != nullptr; Candidate = Candidate->NextFree())
+          LargestFree = (std::max)(LargestFree, Candidate->Size());
+      }
+
+      const Counters Current = GetCounters();
+      OutputBuffer->BytesInUse = BytesInUse();
+      OutputBuffer->PeakBytesInUse = m_PeakBytesInUse;
+      OutputBuffer->BytesCommitted = m_Committed + m_LargeBytes;
+      OutputBuffer->BytesReserved = m_Reserved;
+      OutputBuffer->LargestFreeBlock = LargestFree;
+      OutputBuffer->AllocationCount = m_AllocationCount + m_LargeCount;
+      OutputBuffer->LockCount = Current.LockCount;
+      OutputBuffer->UnlockCount = Current.UnlockCount;
+      OutputBuffer->LockNanoseconds = Current.LockNanoseconds;
+      OutputBuffer->UnlockNanoseconds = Current.UnlockNanoseconds;
+      return 0;
+    }
+
+    size_t Snapshot(void* Buffer, size_t BufferSize, bool Incremental) override {
+      size_t RegionCount = 0;
+      size_t ExtentCount = 0;
+      size_t DataSize = 0;
+      VisitSnapshotExtents(Incremental, [&](uintptr_t Begin, size_t Size) {
+        (void)Begin;
+        ++ExtentCount;
+        DataSize += Size;
+      });
+      for (const LargeRegion& Region : m_LargeRegions)
+        RegionCount += Region.Begin != 0 ? 1 : 0;
+
+      const size_t Required = sizeof(SnapshotHeader) + RegionCount * sizeof(SnapshotRegion) + ExtentCount * sizeof(SnapshotExtent) + DataSize;
+      if (Buffer == nullptr || BufferSize < Required)
+        return Required;
+
+      SnapshotHeader* Header = static_cast<SnapshotHeader*>(Buffer);
+      Header->Magic = SnapshotMagic;
+      Header->Size = Required;
+      Header->Base = m_Base;
+      Header->RegionCount = RegionCount;
+      Header->ExtentCount = ExtentCount;
+      Header->Top = m_Top;
+      Header->TopPrevSize = m_TopPrevSize;
+      std::memcpy(Header->Bins, m_Bins, sizeof(m_Bins));
+      Header->BinMask = m_BinMask;
+      Header->FreeBytes = m_FreeBytes;
+      Header->AllocationCount = m_AllocationCount;
+
+      SnapshotRegion* Regions = reinterpret_cast<SnapshotRegion*>(Header + 1);
+      for (size_t i = 0; i < MaxLargeRegions; ++i) {
+        if (m_LargeRegions[i].Begin != 0)
+          *Regions++ = SnapshotRegion{i, m_LargeRegions[i].Begin, m_LargeRegions[i].Size};
+      }
+
+      // make everything readable at once, so that copying does not fault page by page
+      m_Tracking.store(true, std::memory_order_relaxed);
+      ProtectEverything(PROT_READ);
+
+      SnapshotExtent* Extents = reinterpret_cast<SnapshotExtent*>(Regions);
+      uint8_t* Data = reinterpret_cast<uint8_t*>(Extents + ExtentCount);
+      VisitSnapshotExtents(Incremental, [&](uintptr_t Begin, size_t Size) {
+        *Extents++ = SnapshotExtent{Begin, Size};
+        std::memcpy(Data, reinterpret_cast<const void*>(Begin), Size);
+        Data += Size;
+      });
+
+      ClearBits(m_ModifiedPages, 0, m_Reserved / static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+      for (std::atomic<bool>& Modified : m_LargeModified)
+        Modified.store(false, std::memory_order_relaxed);
+      ResetProtection();
+      return Required;
+    }
+
+    bool Restore(const void* Buffer, size_t BufferSize) override {
+      const SnapshotHeader* Header = static_cast<const SnapshotHeader*>(Buffer);
+      if (Buffer == nullptr || BufferSize < sizeof(SnapshotHeader) || Header->Magic != SnapshotMagic || Header->Size != BufferSize || Header->Base != m_Base)
+        return false;
+      if (Header->RegionCount != m_LargeCount || Header->ExtentCount > BufferSize / sizeof(SnapshotExtent))
+        return false;
+      const size_t TableSize = sizeof(SnapshotHeader) + Header->RegionCount * sizeof(SnapshotRegion) + Header->ExtentCount * sizeof(SnapshotExtent);
+      if (TableSize > BufferSize)
+        return false;
+
+      // separately mapped regions can not be brought back to their old addresses, so they must be unchanged
+      const SnapshotRegion* Regions = reinterpret_cast<const SnapshotRegion*>(Header + 1);
+      for (size_t i = 0; i < Header->RegionCount; ++i) {
+        if (Regions[i].Index >= MaxLargeRegions || m_LargeRegions[Regions[i].Index].Begin != Regions[i].Begin ||
+            m_LargeRegions[Regions[i].Index].Size != Regions[i].Size)
+          return false;
+      }
+
+      const SnapshotExtent* Extents = reinterpret_cast<const SnapshotExtent*>(Regions + Header->RegionCount);
+      size_t DataSize = 0;
+      for (size_t i = 0; i < Header->ExtentCount; ++i) {
+        if (!IsSnapshotExtent(Extents[i]) || Extents[i].Size > BufferSize - TableSize - DataSize)
+          return false;
+        DataSize += Extents[i].Size;
+      }
+      if (TableSize + DataSize != BufferSize || Header->Top < m_Base || Header->Top > m_Base + m_Committed)
+        return false;
+
+      ProtectEverything(PROT_READ | PROT_WRITE);
+      const uint8_t* Data = reinterpret_cast<const uint8_t*>(Extents + Header->ExtentCount);
+      for (size_t i = 0; i < Header->ExtentCount; ++i) {
+        std::memcpy(reinterpret_cast<void*>(Extents[i].Begin), Data, Extents[i].Size);
+        MarkModified(Extents[i].Begin, Extents[i].Begin + Extents[i].Size);
+        Data += Extents[i].Size;
+      }
+
+      m_Top = Header->Top;
+      m_TopPrevSize = Header->TopPrevSize;
+      std::memcpy(m_Bins, Header->Bins, sizeof(m_Bins));
+      m_BinMask = Header->BinMask;
+      m_FreeBytes = Header->FreeBytes;
+      m_AllocationCount = Header->AllocationCount;
+      UpdatePeak();
+
+      ResetProtection();
+      return true;
+    }
+
+    /// @brief Retrieve the counters of this heap.
+    Counters GetCounters() const noexcept {
+      return Counters{
+        m_LockCount.load(std::memory_order_relaxed),
+        m_UnlockCount.load(std::memory_order_relaxed),
+        m_LockNanoseconds.load(std::memory_order_relaxed),
+        m_UnlockNanoseconds.load(std::memory_order_relaxed),
+        m_Faults.load(std::memory_order_relaxed),
+        m_InSectionFaults.load(std::memory_order_relaxed),
+      };
+    }
+
+    /// @brief Count of bytes reserved for this heap.
+    size_t GetReservedSize() const noexcept {
+      return m_Reserved;
+    }
+
+    /// @brief Count of bytes of the reservation that have been used at some point, rounded up to pages.
+    ///
+    /// This does not include allocations of at least 1MB, which are mapped separately.
+    size_t GetCommittedSize() const noexcept {
+      return m_Committed;
+    }
+
+  private:
+    enum : size_t {
+      ReservationGranularity = 0x10000,
+      MinBlockSize = 32,
+      BinCount = 64,
+      UsedFlag = 1,
+      MaxRegistrations = 1024,
+      MaxDirtyRanges = 4096,
+      MaxLargeRegions = 256,
+      LargeAllocationSize = 0x100000,
+      EagerCommitLimit = 0x100000,
+      BitsPerWord = 64,
+    };
+
+    // Identifies buffers written by Snapshot.
+    static constexpr uint64_t SnapshotMagic = 0x50414e5349454854ull;
+
+    // Header in front of every block. Free blocks additionally store their freelist links in the payload.
+    struct Block {
+      size_t PrevSize;
+      size_t SizeAndFlags;
+
+      size_t Size() const {
+        return SizeAndFlags & ~static_cast<size_t>(UsedFlag);
+      }
+
+      bool IsUsed() const {
+        return (SizeAndFlags & UsedFlag) != 0;
+      }
+
+      void SetSize(size_t NewSize, bool Used) {
+        SizeAndFlags = NewSize | (Used ? static_cast<size_t>(UsedFlag) : 0);
+      }
+
+      uint8_t* Begin() {
+        return reinterpret_cast<uint8_t*>(this);
+      }
+
+      uint8_t* End() {
+        return Begin() + Size();
+      }
+
+      void* Payload() {
+        return this + 1;
+      }
+
+      Block*& NextFree() {
+        return static_cast<Block**>(Payload())[0];
+      }
+
+      Block*& PrevFree() {
+        return static_cast<Block**>(Payload())[1];
+      }
+
+      static Block* FromPayload(void* Pointer) {
+        return static_cast<Block*>(Pointer) - 1;
+      }
+    };
+
+    // Range of pages made accessible since the last call to unlock.
+    struct DirtyRange {
+      std::atomic<uintptr_t> Begin;
+      std::atomic<uintptr_t> End;
+    };
+
+    // Registry of the memory of all stand-in heaps, consulted by the fault handler. The range is updated
+    // like a seqlock: the sequence is odd while it is written, so that readers never combine the bounds of
+    // two different ranges.
+    struct Registration {
+      std::atomic<uint32_t> Sequence;
+      std::atomic<uintptr_t> Begin;
+      std::atomic<uintptr_t> End;
+      std::atomic<StandInHeap*> Owner;
+    };
+
+    // Header in front of allocations that are mapped separately.
+    struct LargeHeader {
+      size_t Index;
+      size_t Unused;
+
+      static LargeHeader* FromPayload(void* Pointer) {
+        return static_cast<LargeHeader*>(Pointer) - 1;
+      }
+    };
+
+    // Allocation that is mapped separately, along with its entry in the registry.
+    struct LargeRegion {
+      uintptr_t Begin;
+      size_t Size;
+      Registration* Entry;
+    };
+
+    // Layout of a snapshot: the header is followed by the separately mapped regions at the time of the
+    // snapshot, the copied extents, and the contents of these extents.
+    struct SnapshotHeader {
+      uint64_t Magic;
+      size_t Size;
+      uint8_t* Base;
+      size_t RegionCount;
+      size_t ExtentCount;
+
+      uint8_t* Top;
+      size_t TopPrevSize;
+      Block* Bins[BinCount];
+      uint64_t BinMask;
+      size_t FreeBytes;
+      size_t AllocationCount;
+    };
+
+    struct SnapshotRegion {
+      size_t Index;
+      uintptr_t Begin;
+      size_t Size;
+    };
+
+    struct SnapshotExtent {
+      uintptr_t Begin;
+      size_t Size;
+    };
+
+    StandInHeap(uint8_t* Base, size_t Reserved, size_t MaxAllocSize)
+      : m_Base(Base)
+      , m_Reserved(Reserved)
+      , m_MaxAllocSize(MaxAllocSize)
+      , m_Top(Base) {
+      std::memset(m_Bins, 0, sizeof(m_Bins));
+
+      const size_t PageCount = Reserved / static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      m_ModifiedPages = new (std::nothrow) std::atomic<uint64_t>[(PageCount + BitsPerWord - 1) / BitsPerWord]();
+      m_ReadablePages = new (std::nothrow) std::atomic<uint64_t>[(PageCount + BitsPerWord - 1) / BitsPerWord]();
+    }
+
+    ~StandInHeap() override {
+      delete[] m_ModifiedPages;
+      delete[] m_ReadablePages;
+    }
+
+    static constexpr size_t RoundUp(size_t Value, size_t Alignment) {
+      return (Value + Alignment - 1) & ~(Alignment - 1);
+    }
+
+    static uint64_t ElapsedSince(std::chrono::steady_clock::time_point Start) {
+      return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count());
+    }
+
+    static size_t BlockSizeFor(size_t Size) {
+      const size_t Total = RoundUp(Size, sizeof(Block)) + sizeof(Block);
+      return Total < MinBlockSize ? static_cast<size_t>(MinBlockSize) : Total;
+    }
+
+    static size_t BinIndex(size_t Size) {
+      size_t Index = 0;
+      while ((Size >>= 1) != 0)
+        ++Index;
+      return Index;
+    }
+
+    static Registration* Registrations() {
+      static Registration s_Registrations[MaxRegistrations];
+      return s_Registrations;
+    }
+
+    static struct sigaction& PreviousHandler() {
+      static struct sigaction s_Previous;
+      return s_Previous;
+    }
+
+    static void InstallFaultHandler() {
+      static const bool s_Installed = [] {
+        struct sigaction Action {};
+        Action.sa_sigaction = &OnFault;
+        Action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&Action.sa_mask);
+        return sigaction(SIGSEGV, &Action, &PreviousHandler()) == 0;
+      }();
+      (void)s_Installed;
+    }
+
+    // Make pages of stand-in heaps accessible when they are touched, counting touches from outside of the
+    // critical section. All other faults are forwarded to the previous handler.
+    static void OnFault(int Signal, siginfo_t* Info, void* Context) {
+      const uintptr_t Address = reinterpret_cast<uintptr_t>(Info->si_addr);
+      for (size_t i = 0; i < MaxRegistrations; ++i) {
+        Registration& Entry = Registrations()[i];
+        StandInHeap* Owner = Entry.Owner.load(std::memory_order_acquire);
+        if (Owner == nullptr)
+          continue;
+        uintptr_t Begin = 0;
+        uintptr_t End = 0;
+        ReadRange(Entry, Begin, End);
+        if (Address < Begin || Address >= End || Entry.Owner.load(std::memory_order_relaxed) != Owner)
+          continue;
+        // the reservation is only usable up to the committed size, separately mapped regions entirely
+        if (Begin == reinterpret_cast<uintptr_t>(Owner->m_Base) && Address >= Begin + Owner->m_Committed)
+          break;
+
+        const size_t PageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const uintptr_t Page = Address & ~(PageSize - 1);
+        const bool InSection = Owner->m_InCriticalSection.load(std::memory_order_acquire);
+
+        // once snapshots are taken, pages of the reservation are first made readable only, so that writes
+        // fault again and snapshots can tell them apart from reads
+        if (InSection && Begin == reinterpret_cast<uintptr_t>(Owner->m_Base) && Owner->m_Tracking.load(std::memory_order_relaxed)) {
+          const size_t PageIndex = (Page - Begin) / PageSize;
+          const uint64_t Mask = uint64_t(1) << (PageIndex % BitsPerWord);
+          if ((Owner->m_ReadablePages[PageIndex / BitsPerWord].fetch_or(Mask, std::memory_order_relaxed) & Mask) == 0) {
+            Owner->m_InSectionFaults.fetch_add(1, std::memory_order_relaxed);
+            mprotect(reinterpret_cast<void*>(Page), PageSize, PROT_READ);
+            Owner->MarkDirty(Page, Page + PageSize);
+          } else {
+            mprotect(reinterpret_cast<void*>(Page), PageSize, PROT_READ | PROT_WRITE);
+            Owner->MarkModified(Page, Page + PageSize);
+          }
+          return;
+        }
+
+        if (InSection)
+          Owner->m_InSectionFaults.fetch_add(1, std::memory_order_relaxed);
+        else
+          Owner->m_Faults.fetch_add(1, std::memory_order_relaxed);
+
+        mprotect(reinterpret_cast<void*>(Page), PageSize, PROT_READ | PROT_WRITE);
+        Owner->MarkDirty(Page, Page + PageSize);
+        Owner->MarkModified(Page, Page + PageSize);
+        return;
+      }
+
+      const struct sigaction& Previous = PreviousHandler();
+      if ((Previous.sa_flags & SA_SIGINFO) != 0 && Previous.sa_sigaction != nullptr) {
+        Previous.sa_sigaction(Signal, Info, Context);
+      } else if (Previous.sa_handler != SIG_DFL && Previous.sa_handler != SIG_IGN) {
+        Previous.sa_handler(Signal);
+      } else {
+        // returning re-executes the faulting instruction, which now crashes with the default action
+        signal(SIGSEGV, SIG_DFL);
+      }
+    }
+
+    static void ReadRange(const Registration& Entry, uintptr_t& Begin, uintptr_t& End) {
+      for (;;) {
+        const uint32_t Sequence = Entry.Sequence.load(std::memory_order_acquire);
+        Begin = Entry.Begin.load(std::memory_order_relaxed);
+        End = Entry.End.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((Sequence & 1) == 0 && Entry.Sequence.load(std::memory_order_relaxed) == Sequence)
+          return;
+      }
+    }
+
+    // Write the range of an entry whose sequence the caller made odd.
+    static void WriteRange(Registration& Entry, uint32_t Sequence, uintptr_t Begin, uintptr_t End) {
+      std::atomic_thread_fence(std::memory_order_release);
+      Entry.Begin.store(Begin, std::memory_order_relaxed);
+      Entry.End.store(End, std::memory_order_relaxed);
+      Entry.Sequence.store(Sequence + 1, std::memory_order_release);
+    }
+
+    // Make the fault handler aware of the memory in [Begin, End).
+    Registration* Register(uintptr_t Begin, uintptr_t End) {
+      for (size_t i = 0; i < MaxRegistrations; ++i) {
+        Registration& Entry = Registrations()[i];
+        uint32_t Sequence = Entry.Sequence.load(std::memory_order_relaxed);
+        if ((Sequence & 1) != 0 || Entry.Owner.load(std::memory_order_relaxed) != nullptr)
+          continue;
+        // making the sequence odd claims the entry, which serializes heaps registering at the same time
+        if (!Entry.Sequence.compare_exchange_strong(Sequence, Sequence + 1, std::memory_order_relaxed))
+          continue;
+        WriteRange(Entry, Sequence + 1, Begin, End);
+        Entry.Owner.store(this, std::memory_order_release);
+        return &Entry;
+      }
+      return nullptr;
+    }
+
+    void Unregister() {
+      for (size_t i = 0; i < MaxRegistrations; ++i) {
+        if (Registrations()[i].Owner.load(std::memory_order_relaxed) == this)
+          Registrations()[i].Owner.store(nullptr, std::memory_order_release);
+      }
+    }
+
+    // Ensure that the reservation is usable up to `End`, growing the committed range if needed.
+    bool Commit(uint8_t* End) {
+      if (End > m_Base + m_Reserved || static_cast<size_t>(End - m_Top) > Available())
+        return false;
+
+      const size_t PageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      const size_t Required = RoundUp(static_cast<size_t>(End - m_Base), PageSize);
+      if (Required > m_Committed) {
+        if (mprotect(m_Base + m_Committed, Required - m_Committed, PROT_READ | PROT_WRITE) != 0)
+          return false;
+        MarkDirty(reinterpret_cast<uintptr_t>(m_Base + m_Committed), reinterpret_cast<uintptr_t>(m_Base + Required));
+        MarkModified(reinterpret_cast<uintptr_t>(m_Base + m_Committed), reinterpret_cast<uintptr_t>(m_Base + Required));
+        m_Committed = Required;
+      }
+      return true;
+    }
+
+    // Record that the given pages were made accessible. This is called from the fault handler, so it may
+    // neither allocate nor lock. Once the list of ranges is full, the entire heap is made accessible, and
+    // the next unlock protects all of it instead, which also keeps the number of mappings bounded.
+    void MarkDirty(uintptr_t Begin, uintptr_t End) {
+      const size_t Index = m_DirtyCount.fetch_add(1, std::memory_order_acq_rel);
+      if (Index >= MaxDirtyRanges) {
+        if (!m_DirtyOverflow.exchange(true, std::memory_order_acq_rel))
+          ProtectEverything(PROT_READ | PROT_WRITE);
+        return;
+      }
+
+      m_DirtyRanges[Index].Begin.store(Begin, std::memory_order_relaxed);
+      m_DirtyRanges[Index].End.store(End, std::memory_order_release);
+    }
+
+    // Protect all pages made accessible since the last call, in O(count of such ranges).
+    void ProtectDirtyRanges() {
+      const size_t Count = (std::min)(m_DirtyCount.load(std::memory_order_acquire), static_cast<size_t>(MaxDirtyRanges));
+      bool ProtectAll = Count == MaxDirtyRanges || m_DirtyOverflow.load(std::memory_order_acquire);
+      for (size_t i = 0; i < Count && !ProtectAll; ++i) {
+        // a range that is still being recorded by another thread is not known yet
+        const uintptr_t End = m_DirtyRanges[i].End.exchange(0, std::memory_order_acquire);
+        if (End == 0) {
+          ProtectAll = true;
+          break;
+        }
+        const uintptr_t Begin = m_DirtyRanges[i].Begin.load(std::memory_order_relaxed);
+        mprotect(reinterpret_cast<void*>(Begin), End - Begin, PROT_NONE);
+        ForgetReadable(Begin, End);
+      }
+
+      if (ProtectAll) {
+        ResetProtection();
+        return;
+      }
+
+      m_DirtyOverflow.store(false, std::memory_order_release);
+      m_DirtyCount.store(0, std::memory_order_release);
+    }
+
+    // Protect all memory of the heap and forget all recorded ranges.
+    void ResetProtection() {
+      const size_t Count = (std::min)(m_DirtyCount.load(std::memory_order_acquire), static_cast<size_t>(MaxDirtyRanges));
+      for (size_t i = 0; i < Count; ++i)
+        m_DirtyRanges[i].End.store(0, std::memory_order_relaxed);
+      ProtectEverything(PROT_NONE);
+      ForgetReadable(reinterpret_cast<uintptr_t>(m_Base), reinterpret_cast<uintptr_t>(m_Base + m_Committed));
+
+      m_DirtyOverflow.store(false, std::memory_order_release);
+      m_DirtyCount.store(0, std::memory_order_release);
+    }
+
+    // Record that the given pages may have been written since the last snapshot. This is called from the
+    // fault handler, so it may neither allocate nor lock.
+    void MarkModified(uintptr_t Begin, uintptr_t End) {
+      const uintptr_t Base = reinterpret_cast<uintptr_t>(m_Base);
+      if (Begin >= Base && Begin < Base + m_Reserved) {
+        const size_t PageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        SetBits(m_ModifiedPages, (Begin - Base) / PageSize, (End - Base + PageSize - 1) / PageSize);
+        return;
+      }
+
+      for (size_t i = 0; i < MaxLargeRegions; ++i) {
+        if (Begin >= m_LargeRegions[i].Begin && Begin < m_LargeRegions[i].Begin + m_LargeRegions[i].Size)
+          m_LargeModified[i].store(true, std::memory_order_relaxed);
+      }
+    }
+
+    // Forget which pages of the reservation within [Begin, End) were made readable, once they are protected.
+    void ForgetReadable(uintptr_t Begin, uintptr_t End) {
+      const uintptr_t Base = reinterpret_cast<uintptr_t>(m_Base);
+      if (!m_Tracking.load(std::memory_order_relaxed) || Begin < Base || Begin >= Base + m_Reserved)
+        return;
+      const size_t PageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      ClearBits(m_ReadablePages, (Begin - Base) / PageSize, (End - Base + PageSize - 1) / PageSize);
+    }
+
+    static void SetBits(std::atomic<uint64_t>* Bits, size_t First, size_t Last) {
+      for (size_t Index = First; Index < Last;) {
+        const size_t Count = (std::min)(Last - Index, BitsPerWord - Index % BitsPerWord);
+        const uint64_t Mask = (Count == BitsPerWord ? ~uint64_t(0) : (uint64_t(1) << Count) - 1) << (Index % BitsPerWord);
+        Bits[Index / BitsPerWord].fetch_or(Mask, std::memory_order_relaxed);
+        Index += Count;
+      }
+    }
+
+    static void ClearBits(std::atomic<uint64_t>* Bits, size_t First, size_t Last) {
+      for (size_t Index = First; Index < Last;) {
+        const size_t Count = (std::min)(Last - Index, BitsPerWord - Index % BitsPerWord);
+        const uint64_t Mask = (Count == BitsPerWord ? ~uint64_t(0) : (uint64_t(1) << Count) - 1) << (Index % BitsPerWord);
+        Bits[Index / BitsPerWord].fetch_and(~Mask, std::memory_order_relaxed);
+        Index += Count;
+      }
+    }
+
+    // Call `Visit` with the address and size of every range of memory that belongs into a snapshot, which
+    // are all used pages of the reservation and all separately mapped regions, or the modified ones thereof.
+    template <typename F>
+    void VisitSnapshotExtents(bool Incremental, F&& Visit) const {
+      const size_t PageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      const size_t UsedPages = RoundUp(static_cast<size_t>(m_Top - m_Base), PageSize) / PageSize;
+      const uintptr_t Base = reinterpret_cast<uintptr_t>(m_Base);
+
+      if (!Incremental && UsedPages != 0)
+        Visit(Base, UsedPages * PageSize);
+      for (size_t Page = 0; Incremental && Page < UsedPages;) {
+        if ((m_ModifiedPages[Page / BitsPerWord].load(std::memory_order_relaxed) & (uint64_t(1) << (Page % BitsPerWord))) == 0) {
+          ++Page;
+          continue;
+        }
+        const size_t First = Page;
+        while (Page < UsedPages && (m_ModifiedPages[Page / BitsPerWord].load(std::memory_order_relaxed) & (uint64_t(1) << (Page % BitsPerWord))) != 0)
+          ++Page;
+        Visit(Base + First * PageSize, (Page - First) * PageSize);
+      }
+
+      for (size_t i = 0; i < MaxLargeRegions; ++i) {
+        if (m_LargeRegions[i].Begin != 0 && (!Incremental || m_LargeModified[i].load(std::memory_order_relaxed)))
+          Visit(m_LargeRegions[i].Begin, m_LargeRegions[i].Size);
+      }
+    }
+
+    // Whether a snapshot may write to the given extent, which is either within the committed part of the
+    // reservation or a separately mapped region.
+    bool IsSnapshotExtent(const SnapshotExtent& Extent) const {
+      const uintptr_t Base = reinterpret_cast<uintptr_t>(m_Base);
+      if (Extent.Begin >= Base && Extent.Begin <= Base + m_Committed)
+        return Extent.Size <= Base + m_Committed - Extent.Begin;
+      for (const LargeRegion& Region : m_LargeRegions) {
+        if (Region.Begin != 0 && Extent.Begin == Region.Begin && Extent.Size == Region.Size)
+          return true;
+      }
+      return false;
+    }
+
+    // Change the protection of all memory of the heap.
+    void ProtectEverything(int Protection) {
+      if (m_Committed != 0)
+        mprotect(m_Base, m_Committed, Protection);
+      for (const LargeRegion& Region : m_LargeRegions) {
+        if (Region.Begin != 0)
+          mprotect(reinterpret_cast<void*>(Region.Begin), Region.Size, Protection);
+      }
+    }
+
+    // Forget recorded ranges within [Begin, End), before that memory is unmapped or moved.
+    void DropDirty(uintptr_t Begin, uintptr_t End) {
+      const size_t Count = (std::min)(m_DirtyCount.load(std::memory_order_acquire), static_cast<size_t>(MaxDirtyRanges));
+      for (size_t i = 0; i < Count; ++i) {
+        DirtyRange& Range = m_DirtyRanges[i];
+        const uintptr_t RangeBegin = Range.Begin.load(std::memory_order_relaxed);
+        if (RangeBegin >= Begin && RangeBegin < End)
+          Range.Begin.store(Range.End.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      }
+    }
+
+    bool IsLarge(const void* Pointer) const {
+      const uint8_t* Address = static_cast<const uint8_t*>(Pointer);
+      return Pointer != nullptr && (Address < m_Base || Address >= m_Base + m_Reserved);
+    }
+
+    // Map `Size` bytes aligned to 64kB, like VirtualAlloc does on Windows, so that no other mapping shares a
+    // 64kB granule with it. `Size` must be a multiple of ReservationGranularity.
+    static void* MapAligned(size_t Size, int Protection) {
+      void* Mapping = mmap(nullptr, Size + ReservationGranularity, Protection, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (Mapping == MAP_FAILED)
+        return nullptr;
+
+      const uintptr_t Raw = reinterpret_cast<uintptr_t>(Mapping);
+      const uintptr_t Base = RoundUp(Raw, ReservationGranularity);
+      if (Base != Raw)
+        munmap(Mapping, Base - Raw);
+      if (Base + Size != Raw + Size + ReservationGranularity)
+        munmap(reinterpret_cast<void*>(Base + Size), Raw + ReservationGranularity - Base);
+      return reinterpret_cast<void*>(Base);
+    }
+
+    // Map a separate region for an allocation of at least LargeAllocationSize bytes. Regions are 64kB
+    // granular like the reservation itself.
+    void* AllocateLarge(size_t Size) {
+      if (Size > Available())
+        return nullptr;
+      const size_t MappingSize = RoundUp(Size + sizeof(LargeHeader), ReservationGranularity);
+      if (MappingSize > Available())
+        return nullptr;
+
+      size_t Index = 0;
+      while (Index < MaxLargeRegions && m_LargeRegions[Index].Begin != 0)
+        ++Index;
+      if (Index == MaxLargeRegions)
+        return nullptr;
+
+      void* Mapping = MapAligned(MappingSize, PROT_READ | PROT_WRITE);
+      if (Mapping == nullptr)
+        return nullptr;
+
+      const uintptr_t Begin = reinterpret_cast<uintptr_t>(Mapping);
+      Registration* Entry = Register(Begin, Begin + MappingSize);
+      if (Entry == nullptr) {
+        munmap(Mapping, MappingSize);
+        return nullptr;
+      }
+
+      m_LargeRegions[Index] = LargeRegion{Begin, MappingSize, Entry};
+      m_LargeModified[Index].store(true, std::memory_order_relaxed);
+      m_LargeBytes += MappingSize;
+      ++m_LargeCount;
+      MarkDirty(Begin, Begin + MappingSize);
+
+      LargeHeader* Header = static_cast<LargeHeader*>(Mapping);
+      Header->Index = Index;
+      return Header + 1;
+    }
+
+    void FreeLarge(void* Pointer) {
+      LargeRegion& Region = m_LargeRegions[LargeHeader::FromPayload(Pointer)->Index];
+      DropDirty(Region.Begin, Region.Begin + Region.Size);
+      Region.Entry->Owner.store(nullptr, std::memory_order_release);
+      munmap(reinterpret_cast<void*>(Region.Begin), Region.Size);
+
+      m_LargeBytes -= Region.Size;
+      --m_LargeCount;
+      Region = LargeRegion{};
+    }
+
+    // Resize a separately mapped region by remapping its pages, which may move it without copying.
+    void* ResizeLarge(void* Pointer, size_t Size) {
+      LargeRegion& Region = m_LargeRegions[LargeHeader::FromPayload(Pointer)->Index];
+      const size_t MappingSize = RoundUp(Size + sizeof(LargeHeader), ReservationGranularity);
+      if (MappingSize == Region.Size)
+        return Pointer;
+      if (MappingSize > Region.Size && MappingSize - Region.Size > Available())
+        return nullptr;
+
+      // mremap requires the region to be a single mapping, so its pages need the same protection
+      if (mprotect(reinterpret_cast<void*>(Region.Begin), Region.Size, PROT_READ | PROT_WRITE) != 0)
+        return nullptr;
+      DropDirty(Region.Begin, Region.Begin + Region.Size);
+
+      // resize in place if possible, and otherwise move the pages to a new 64kB aligned range
+      void* Mapping = mremap(reinterpret_cast<void*>(Region.Begin), Region.Size, MappingSize, 0);
+      if (Mapping == MAP_FAILED) {
+        void* Target = MapAligned(MappingSize, PROT_NONE);
+        if (Target != nullptr) {
+          Mapping = mremap(reinterpret_cast<void*>(Region.Begin), Region.Size, MappingSize, MREMAP_MAYMOVE | MREMAP_FIXED, Target);
+          if (Mapping == MAP_FAILED)
+            munmap(Target, MappingSize);
+        }
+      }
+      if (Mapping == MAP_FAILED) {
+        MarkDirty(Region.Begin, Region.Begin + Region.Size);
+        return nullptr;
+      }
+
+      const uintptr_t Begin = reinterpret_cast<uintptr_t>(Mapping);
+      const uint32_t Sequence = Region.Entry->Sequence.load(std::memory_order_relaxed) + 1;
+      Region.Entry->Sequence.store(Sequence, std::memory_order_relaxed);
+      WriteRange(*Region.Entry, Sequence, Begin, Begin + MappingSize);
+      m_LargeBytes += MappingSize;
+      m_LargeBytes -= Region.Size;
+      Region.Begin = Begin;
+      Region.Size = MappingSize;
+      MarkDirty(Begin, Begin + MappingSize);
+      MarkModified(Begin, Begin + MappingSize);
+      return static_cast<LargeHeader*>(Mapping) + 1;
+    }
+
+    size_t BytesInUse() const {
+      return static_cast<size_t>(m_Top - m_Base) - m_FreeBytes + m_LargeBytes;
+    }
+
+    // Count of bytes of the reservation that are neither used by blocks nor by separately mapped regions.
+    size_t Available() const {
+      return m_Reserved - static_cast<size_t>(m_Top - m_Base) - m_LargeBytes;
+    }
+
+    void UpdatePeak() {
+      m_PeakBytesInUse = (std::max)(m_PeakBytesInUse, BytesInUse());
+    }
+
+    void Link(Block* Target) {
+      const size_t Index = BinIndex(Target->Size());
+      m_FreeBytes += Target->Size();
+      Target->PrevFree() = nullptr;
+      Target->NextFree() = m_Bins[Index];
+      if (m_Bins[Index] != nullptr)
+        m_Bins[Index]->PrevFree() = Target;
+      m_Bins[Index] = Target;
+      m_BinMask |= uint64_t(1) << Index;
+    }
+
+    void Unlink(Block* Target) {
+      const size_t Index = BinIndex(Target->Size());
+      m_FreeBytes -= Target->Size();
+      if (Target->PrevFree() != nullptr)
+        Target->PrevFree()->NextFree() = Target->NextFree();
+      else
+        m_Bins[Index] = Target->NextFree();
+      if (Target->NextFree() != nullptr)
+        Target->NextFree()->PrevFree() = Target->PrevFree();
+      if (m_Bins[Index] == nullptr)
+        m_BinMask &= ~(uint64_t(1) << Index);
+    }
+
+    // Update the back-reference of the block following `Target`, if any.
+    void FixSuccessor(Block* Target) {
+      if (Target->End() != m_Top)
+        reinterpret_cast<Block*>(Target->End())->PrevSize = Target->Size();
+      else
+        m_TopPrevSize = Target->Size();
+    }
+
+    Block* AllocateBlock(size_t Size) {
+      // first fit within the bin of the requested size, then any block from a bigger bin
+      const size_t Index = BinIndex(Size);
+      Block* Found = nullptr;
+      for (Block* Candidate = m_Bins[Index]; Candidate != nullptr; Candidate = Candidate->NextFree()) {
+        if (Candidate->Size() >= Size) {
+          Found = Candidate;
+          break;
+        }
+      }
+
+      const uint64_t Bigger = Index + 1 < BinCount ? m_BinMask & ~((uint64_t(2) << Index) - 1) : 0;
+      if (Found == nullptr && Bigger != 0)
+        Found = m_Bins[BinIndex(static_cast<size_t>(Bigger & (~Bigger + 1)))];
+
+      if (Found != nullptr) {
+        Unlink(Found);
+        Found->SetSize(Found->Size(), true);
+        ++m_AllocationCount;
+        ShrinkBlock(Found, Size);
+        return Found;
+      }
+
+      // carve a new block from the unused tail of the reservation
+      if (Size > static_cast<size_t>(m_Base + m_Reserved - m_Top) || !Commit(m_Top + Size))
+        return nullptr;
+
+      Block* Result = reinterpret_cast<Block*>(m_Top);
+      Result->PrevSize = m_TopPrevSize;
+      Result->SetSize(Size, true);
+      m_Top += Size;
+      m_TopPrevSize = Size;
+      ++m_AllocationCount;
+      return Result;
+    }
+
+    // Split off the tail of a used block beyond `Size`, if it is big enough to form a block of its own.
+    void ShrinkBlock(Block* Target, size_t Size) {
+      if (Target->Size() - Size < MinBlockSize)
+        return;
+
+      Block* Remainder = reinterpret_cast<Block*>(Target->Begin() + Size);
+      Remainder->PrevSize = Size;
+      Remainder->SetSize(Target->Size() - Size, true);
+      Target->SetSize(Size, true);
+      FixSuccessor(Remainder);
+
+      // the remainder is released like a separate allocation
+      ++m_AllocationCount;
+      FreeBlock(Remainder);
+    }
+
+    // Free a block and coalesce it with its free neighbours, or return it to the unused tail.
+    void FreeBlock(Block* Target) {
+      Target->SetSize(Target->Size(), false);
+      --m_AllocationCount;
+
+      if (Target->End() != m_Top) {
+        Block* Successor = reinterpret_cast<Block*>(Target->End());
+        if (!Successor->IsUsed()) {
+          Unlink(Successor);
+          Target->SetSize(Target->Size() + Successor->Size(), false);
+        }
+      }
+
+      if (Target->Begin() != m_Base) {
+        Block* Predecessor = reinterpret_cast<Block*>(Target->Begin() - Target->PrevSize);
+        if (!Predecessor->IsUsed()) {
+          Unlink(Predecessor);
+          Predecessor->SetSize(Predecessor->Size() + Target->Size(), false);
+          Target = Predecessor;
+        }
+      }
+
+      if (Target->End() == m_Top) {
+        m_Top = Target->Begin();
+        m_TopPrevSize = Target->PrevSize;
+        return;
+      }
+
+      FixSuccessor(Target);
+      Link(Target);
+    }
+
+    void* MoveBlock(Block* Current, size_t Size) {
+      void* Result = Allocate(Size);
+      if (Result != nullptr) {
+        std::memcpy(Result, Current->Payload(), Current->Size() - sizeof(Block));
+        FreeBlock(Current);
+      }
+      return Result;
+    }
+
+    uint8_t* m_Base;
+    size_t m_Reserved;
+    size_t m_MaxAllocSize;
+    size_t m_Committed = 0;
+
+    uint8_t* m_Top;
+    size_t m_TopPrevSize = 0;
+    Block* m_Bins[BinCount];
+    uint64_t m_BinMask = 0;
+    size_t m_FreeBytes = 0;
+    size_t m_PeakBytesInUse = 0;
+    size_t m_AllocationCount = 0;
+
+    LargeRegion m_LargeRegions[MaxLargeRegions]{};
+    size_t m_LargeBytes = 0;
+    size_t m_LargeCount = 0;
+
+    std::atomic<bool> m_InCriticalSection{false};
+    std::atomic<uint64_t> m_LockCount{0};
+    std::atomic<uint64_t> m_UnlockCount{0};
+    std::atomic<uint64_t> m_LockNanoseconds{0};
+    std::atomic<uint64_t> m_UnlockNanoseconds{0};
+    std::atomic<uint64_t> m_Faults{0};
+    std::atomic<uint64_t> m_InSectionFaults{0};
+
+    std::atomic<size_t> m_DirtyCount{0};
+    std::atomic<bool> m_DirtyOverflow{false};
+    DirtyRange m_DirtyRanges[MaxDirtyRanges]{};
+
+    // pages written since the last snapshot, one bit per page of the reservation, and separately mapped
+    // regions written since the last snapshot
+    std::atomic<uint64_t>* m_ModifiedPages = nullptr;
+    std::atomic<bool> m_LargeModified[MaxLargeRegions]{};
+
+    // once a snapshot was taken, pages of the reservation made readable in the current critical section
+    std::atomic<bool> m_Tracking{false};
+    std::atomic<uint64_t>* m_ReadablePages = nullptr;
+  };
+} // namespace THEIA_REAL_NAMESPACE
+
+namespace THEIA_REAL_NAMESPACE {
+  inline StandInHeap* StandInHeap::FromHeap(Heap* TargetHeap) {
+    // stand-in heaps are told apart by their registration, as emulated runtimes report being protected
+    for (size_t i = 0; i < MaxRegistrations; ++i) {
+      StandInHeap* Owner = Registrations()[i].Owner.load(std::memory_order_acquire);
+      if (Owner != nullptr && static_cast<Heap*>(Owner) == TargetHeap)
+        return Owner;
+    }
+    return nullptr;
+  }
+} // namespace THEIA_REAL_NAMESPACE
+
+namespace THEIA_REAL_NAMESPACE {
+  namespace detail {
+    template <typename>
+    Heap* CreateStandInHeap(size_t ReservedSize, size_t MaxAllocSize) {
+      return StandInHeap::Create(ReservedSize, MaxAllocSize);
+    }
+  } // namespace detail
+} // namespace THEIA_REAL_NAMESPACE